@@ -1,122 +1,1676 @@
 #include <stdio.h>
 #include <stdlib.h>
+#include <stdint.h>
 #include <time.h>
 #include <string.h>
+#include <math.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <unistd.h>
+#include <stdarg.h>
+#include <limits.h>
+#include <sys/ioctl.h>
 
-#define MAX_SIZE 10
-#define MAX_MOVES 1000
+#define CLASSIC_MIN_SIZE 2
+#define CLASSIC_MAX_SIZE 10
+#define MAX_BOARD_SIZE 1000000000
+#define DEFAULT_DENSITY 0.15
+#define CHUNK_SHIFT 5
+#define CHUNK_SIZE (1 << CHUNK_SHIFT)
+#define CHUNK_MASK (CHUNK_SIZE - 1)
+#define CHUNK_BYTES (CHUNK_SIZE * CHUNK_SIZE / 8)
+#define MINE_CACHE_CHUNKS 1024
+#define VIEW_SIZE 20
+#define FRAME_HEADER_LINES 3
+#define MESSAGE_LINES 8
+#define MAX_SAVED_MAP 100
+#define HISTORY_BLOCK_BYTES 4096
+#define REGION_LABEL_SIZE 1024
+#define MAX_SOLVER_THREADS 64
+#define MAX_COMPONENT_VARS 256
+#define ENUMERATION_LIMIT (1 << 22)
+#define MAX_CONVOLUTION_WORK (1 << 22)
+#define AUTO_MOVE_LIMIT 10000
+#define MAX_SWEEP_VALUES 16
+#define GUESS_BUCKETS 12
+#define HISTOGRAM_WIDTH 40
+#define GAME_SLAB_SIZE 64
+#define NO_GUESS_CANDIDATE_LIMIT 1000000
+#define GRADE_BLOCK 4096
+#define LOG_MAGIC "MSWL"
+#define LOG_VERSION 1
+#define DEFAULT_LOG "games.log"
 
-int board_size;
-int mine_board[MAX_SIZE][MAX_SIZE];
-int revealed[MAX_SIZE][MAX_SIZE];
-int game_over = 0;
-int move_rows[MAX_MOVES];
-int move_cols[MAX_MOVES];
-int move_top = 0;
-int push_count[MAX_MOVES];
-int move_history_top = 0;
+#define VAR_UNKNOWN 0
+#define VAR_SAFE 1
+#define VAR_MINE 2
 
-void push(int row, int col) {
-    if (move_top < MAX_MOVES) {
-        move_rows[move_top] = row;
-        move_cols[move_top] = col;
-        move_top++;
+#define LOG_REVEAL 0
+#define LOG_UNDO 1
+#define LOG_REDO 2
+#define LOG_END 3
+
+#define LOG_QUIT 0
+#define LOG_WON 1
+#define LOG_LOST 2
+
+typedef struct {
+    int start;
+    int count;
+} Span;
+
+/* Position while decoding one recorded reveal group. */
+typedef struct {
+    long long offset;
+    long long runs_left;
+    long long cell;
+    long long run_end;
+    int region;
+} GroupReader;
+
+/* Mine layout and neighbour counts of one chunk. These are a pure function of the seed and the chunk
+   position, so they live in a bounded cache and are simply rebuilt if evicted. */
+typedef struct {
+    long long key;
+    uint32_t mines[CHUNK_SIZE];
+    unsigned char counts[CHUNK_SIZE][CHUNK_SIZE];
+    int newer;
+    int older;
+    int next_in_bucket;
+} MineChunk;
+
+/* Revealed bits of a chunk the player has opened something in. This is the only state that cannot be
+   regenerated, so it is kept for the whole game and allocated only where the player has been. */
+typedef struct {
+    long long key;
+    unsigned char *revealed;
+} TouchedChunk;
+
+/* An unrevealed cell next to at least one revealed number, as seen by the solver. */
+typedef struct {
+    long long cell;
+    int state;
+    int component;
+    int local;
+    int first_link;
+    int link_count;
+    double probability;
+} Variable;
+
+/* A revealed number and the unrevealed cells around it. */
+typedef struct {
+    int vars[8];
+    int var_count;
+    int mines;
+} Constraint;
+
+/* Unknown frontier cells tied together by constraints, with its solutions counted by how many mines they
+   use. hits[i * (var_count + 1) + m] counts the solutions with m mines that put a mine on cell i. */
+typedef struct {
+    int *vars;
+    int var_count;
+    int *constraints;
+    int constraint_count;
+    double *solutions;
+    double *hits;
+    int exact;
+} Component;
+
+typedef struct {
+    long long games;
+    long long wins;
+    long long guesses;
+    long long games_by_guesses[GUESS_BUCKETS];
+    long long wins_by_guesses[GUESS_BUCKETS];
+} SimulationTotals;
+
+typedef struct {
+    long long *safe_cells;
+    int safe_count;
+    int mine_count;
+    int guess_row;
+    int guess_col;
+    double guess_probability;
+} Solution;
+
+/* Everything one game needs: the board, what the player has revealed, the undo history and the solver's
+   scratch space. Functions take the game they work on, so any number of games can run side by side. */
+typedef struct Game {
+    int board_size;
+    double mine_density;
+    uint64_t board_seed;
+    long long total_mines;
+    long long revealed_count;
+    int game_over;
+    int view_row;
+    int view_col;
+    int view_height;
+    int view_width;
+
+    int terminal;
+    int screen_rows;
+    int screen_ready;
+    int shown_row;
+    int shown_col;
+    char *shown;
+    char *row_glyphs;
+    int shown_capacity;
+    char *frame;
+    int frame_capacity;
+    int frame_length;
+
+    MineChunk *mine_cache;
+    int mine_cache_capacity;
+    int mine_cache_allocated;
+    int *mine_cache_bucket;
+    int mine_cache_bucket_bits;
+    int mine_cache_used;
+    int mine_cache_newest;
+    int mine_cache_oldest;
+    MineChunk *last_mine_chunk;
+    TouchedChunk *touched_chunks;
+    int touched_capacity;
+    int touched_count;
+    TouchedChunk *last_touched_chunk;
+
+    long long *fill_cells;
+    int fill_count;
+    int fill_capacity;
+    unsigned char **history_blocks;
+    int history_block_count;
+    long long history_bytes;
+    long long *group_offsets;
+    int group_count;
+    int group_top;
+    int group_capacity;
+
+    int regions_labelled;
+    int *region_of;
+    int region_of_capacity;
+    Span *regions;
+    int region_count;
+    int region_capacity;
+    int *region_cells;
+    int region_cells_capacity;
+    int fill_region;
+    FILE *log;
+
+    Variable *variables;
+    int var_count;
+    int var_capacity;
+    int *var_slots;
+    int var_table_capacity;
+    int *var_links;
+    Constraint *constraints;
+    int constraint_count;
+    int constraint_capacity;
+    int *constraint_component;
+    int *constraint_local;
+    Component *components;
+    int component_count;
+    int component_capacity;
+    int *component_vars;
+    int *component_constraints;
+    atomic_int next_component;
+    int solver_threads;
+
+    struct Game *next_free;
+} Game;
+
+/* Hands out games from slabs of GAME_SLAB_SIZE. A released game keeps its buffers, so the next game that
+   takes it over does not allocate them again. */
+typedef struct {
+    Game **slabs;
+    int slab_count;
+    Game *free_games;
+    int live_games;
+    pthread_mutex_t lock;
+} GamePool;
+
+uint64_t splitmix64(uint64_t *state) {
+    uint64_t z = (*state += 0x9E3779B97F4A7C15ULL);
+    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+    z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+    return z ^ (z >> 31);
+}
+
+long long chunk_key(int chunk_row, int chunk_col) {
+    return ((long long)chunk_row << 32) | (unsigned)chunk_col;
+}
+
+int chunk_extent(Game *game, int chunk_index) {
+    int remaining = game->board_size - (chunk_index << CHUNK_SHIFT);
+    return remaining < CHUNK_SIZE ? remaining : CHUNK_SIZE;
+}
+
+/* Uniform draw below bound by multiply-shift, which needs no division and no retry loop. */
+int random_below(uint64_t *state, int bound) {
+    return (int)(((splitmix64(state) & 0xFFFFFFFF) * (uint64_t)bound) >> 32);
+}
+
+/* Chunks share out the board's mines by cumulative rounding over the cells before and up to each chunk in
+   row-major chunk order, so every chunk gets its proportional share and the shares add up to exactly
+   total_mines. */
+int chunk_mine_count(Game *game, int chunk_row, int chunk_col) {
+    __int128 cells = (__int128)game->board_size * game->board_size;
+    long long before = (long long)chunk_row * CHUNK_SIZE * game->board_size + (long long)chunk_extent(game, chunk_row) * chunk_col * CHUNK_SIZE;
+    long long after = before + (long long)chunk_extent(game, chunk_row) * chunk_extent(game, chunk_col);
+    return (int)((__int128)after * game->total_mines / cells - (__int128)before * game->total_mines / cells);
+}
+
+/* Every chunk holds its share of the board's mines, drawn from a generator seeded with the board seed and
+   the chunk position. Floyd's sampling picks them in exactly one draw per mine at any density: for each of
+   the last num_mines cell positions j, draw t up to j and take t, or j itself if t is already a mine.
+   Chunks off the board come back empty. */
+void generate_chunk_mines(Game *game, int chunk_row, int chunk_col, uint32_t mines[CHUNK_SIZE]) {
+    int j;
+
+    memset(mines, 0, CHUNK_SIZE * sizeof(uint32_t));
+    if (chunk_row < 0 || chunk_col < 0 || chunk_row > (game->board_size - 1) >> CHUNK_SHIFT || chunk_col > (game->board_size - 1) >> CHUNK_SHIFT) return;
+
+    int cols = chunk_extent(game, chunk_col);
+    int cells = chunk_extent(game, chunk_row) * cols;
+    int num_mines = chunk_mine_count(game, chunk_row, chunk_col);
+    uint64_t state = game->board_seed ^ ((uint64_t)chunk_key(chunk_row, chunk_col) * 0xD1B54A32D192ED03ULL);
+    for (j = cells - num_mines; j < cells; j++) {
+        int pick = random_below(&state, j + 1);
+        if (mines[pick / cols] >> (pick % cols) & 1) pick = j;
+        mines[pick / cols] |= 1u << (pick % cols);
+    }
+}
+
+/* 3x3 box sum as two separable passes over a zero-bordered byte copy of the mines. The border comes from
+   the eight surrounding chunks. The inner loops are branch free runs over contiguous bytes, which the
+   compiler turns into vector adds. */
+void count_neighbours(Game *game, MineChunk *chunk, int chunk_row, int chunk_col) {
+    uint32_t around[3][3][CHUNK_SIZE];
+    unsigned char padded[CHUNK_SIZE + 2][CHUNK_SIZE + 2];
+    unsigned char row_sums[CHUNK_SIZE + 2][CHUNK_SIZE];
+    int i, j;
+
+    for (i = 0; i < 3; i++) {
+        for (j = 0; j < 3; j++) {
+            if (i == 1 && j == 1) {
+                memcpy(around[1][1], chunk->mines, sizeof(chunk->mines));
+            } else {
+                generate_chunk_mines(game, chunk_row + i - 1, chunk_col + j - 1, around[i][j]);
+            }
+        }
+    }
+    for (i = 0; i < CHUNK_SIZE + 2; i++) {
+        int block_row = (i + CHUNK_SIZE - 1) >> CHUNK_SHIFT;
+        int r = (i + CHUNK_SIZE - 1) & CHUNK_MASK;
+        for (j = 0; j < CHUNK_SIZE + 2; j++) {
+            int block_col = (j + CHUNK_SIZE - 1) >> CHUNK_SHIFT;
+            int c = (j + CHUNK_SIZE - 1) & CHUNK_MASK;
+            padded[i][j] = around[block_row][block_col][r] >> c & 1;
+        }
+    }
+    for (i = 0; i < CHUNK_SIZE + 2; i++) {
+        for (j = 0; j < CHUNK_SIZE; j++) {
+            row_sums[i][j] = padded[i][j] + padded[i][j + 1] + padded[i][j + 2];
+        }
+    }
+    for (i = 0; i < CHUNK_SIZE; i++) {
+        for (j = 0; j < CHUNK_SIZE; j++) {
+            chunk->counts[i][j] = row_sums[i][j] + row_sums[i + 1][j] + row_sums[i + 2][j];
+        }
+    }
+}
+
+void unlink_mine_chunk(Game *game, int index) {
+    MineChunk *chunk = &game->mine_cache[index];
+    if (chunk->newer >= 0) game->mine_cache[chunk->newer].older = chunk->older; else game->mine_cache_newest = chunk->older;
+    if (chunk->older >= 0) game->mine_cache[chunk->older].newer = chunk->newer; else game->mine_cache_oldest = chunk->newer;
+}
+
+int mine_cache_slot(Game *game, long long key) {
+    return (int)(((uint64_t)key * 0x9E3779B97F4A7C15ULL) >> (64 - game->mine_cache_bucket_bits));
+}
+
+/* Least recently used chunk is evicted once the cache is full. */
+MineChunk *load_mine_chunk(Game *game, int chunk_row, int chunk_col) {
+    long long key = chunk_key(chunk_row, chunk_col);
+    if (game->last_mine_chunk && game->last_mine_chunk->key == key) return game->last_mine_chunk;
+
+    int slot = mine_cache_slot(game, key);
+    int index = game->mine_cache_bucket[slot];
+    while (index >= 0 && game->mine_cache[index].key != key) index = game->mine_cache[index].next_in_bucket;
+
+    if (index >= 0) {
+        unlink_mine_chunk(game, index);
+    } else {
+        if (game->mine_cache_used < game->mine_cache_capacity) {
+            index = game->mine_cache_used++;
+        } else {
+            index = game->mine_cache_oldest;
+            unlink_mine_chunk(game, index);
+            int *link = &game->mine_cache_bucket[mine_cache_slot(game, game->mine_cache[index].key)];
+            while (*link != index) link = &game->mine_cache[*link].next_in_bucket;
+            *link = game->mine_cache[index].next_in_bucket;
+        }
+        MineChunk *chunk = &game->mine_cache[index];
+        chunk->key = key;
+        generate_chunk_mines(game, chunk_row, chunk_col, chunk->mines);
+        count_neighbours(game, chunk, chunk_row, chunk_col);
+        chunk->next_in_bucket = game->mine_cache_bucket[slot];
+        game->mine_cache_bucket[slot] = index;
+    }
+
+    game->mine_cache[index].older = game->mine_cache_newest;
+    game->mine_cache[index].newer = -1;
+    if (game->mine_cache_newest >= 0) game->mine_cache[game->mine_cache_newest].newer = index; else game->mine_cache_oldest = index;
+    game->mine_cache_newest = index;
+    game->last_mine_chunk = &game->mine_cache[index];
+    return game->last_mine_chunk;
+}
+
+int is_mine(Game *game, int r, int c) {
+    MineChunk *chunk = load_mine_chunk(game, r >> CHUNK_SHIFT, c >> CHUNK_SHIFT);
+    return chunk->mines[r & CHUNK_MASK] >> (c & CHUNK_MASK) & 1;
+}
+
+int count_mines(Game *game, int r, int c) {
+    return load_mine_chunk(game, r >> CHUNK_SHIFT, c >> CHUNK_SHIFT)->counts[r & CHUNK_MASK][c & CHUNK_MASK];
+}
+
+/* Open addressing table of touched chunks, doubled whenever it gets half full. Returns NULL if the chunk
+   has not been touched, or if it could not be created. */
+TouchedChunk *find_touched_chunk(Game *game, int chunk_row, int chunk_col, int create) {
+    long long key = chunk_key(chunk_row, chunk_col);
+    if (game->last_touched_chunk && game->last_touched_chunk->key == key) return game->last_touched_chunk;
+
+    if (create && (game->touched_count + 1) * 2 > game->touched_capacity) {
+        TouchedChunk *old = game->touched_chunks;
+        int old_capacity = game->touched_capacity;
+        int capacity = old_capacity ? old_capacity * 2 : 64;
+        TouchedChunk *chunks = calloc(capacity, sizeof(TouchedChunk));
+        int i;
+        if (!chunks) {
+            printf("Could not grow the revealed cells table, cells there stay hidden.\n");
+            return NULL;
+        }
+        game->touched_capacity = capacity;
+        game->touched_chunks = chunks;
+        for (i = 0; i < old_capacity; i++) {
+            if (old[i].revealed) {
+                int slot = (int)(((uint64_t)old[i].key * 0x9E3779B97F4A7C15ULL) >> 32) & (game->touched_capacity - 1);
+                while (game->touched_chunks[slot].revealed) slot = (slot + 1) & (game->touched_capacity - 1);
+                game->touched_chunks[slot] = old[i];
+            }
+        }
+        free(old);
+        game->last_touched_chunk = NULL;
+    }
+    if (!game->touched_capacity) return NULL;
+
+    int slot = (int)(((uint64_t)key * 0x9E3779B97F4A7C15ULL) >> 32) & (game->touched_capacity - 1);
+    while (game->touched_chunks[slot].revealed && game->touched_chunks[slot].key != key) slot = (slot + 1) & (game->touched_capacity - 1);
+    if (!game->touched_chunks[slot].revealed) {
+        unsigned char *revealed;
+        if (!create) return NULL;
+        revealed = calloc(CHUNK_BYTES, 1);
+        if (!revealed) {
+            printf("Could not allocate chunk (%d, %d), cells there stay hidden.\n", chunk_row, chunk_col);
+            return NULL;
+        }
+        game->touched_chunks[slot].key = key;
+        game->touched_chunks[slot].revealed = revealed;
+        game->touched_count++;
+    }
+    game->last_touched_chunk = &game->touched_chunks[slot];
+    return game->last_touched_chunk;
+}
+
+int is_revealed(Game *game, int r, int c) {
+    TouchedChunk *chunk = find_touched_chunk(game, r >> CHUNK_SHIFT, c >> CHUNK_SHIFT, 0);
+    if (!chunk) return 0;
+    int bit = ((r & CHUNK_MASK) << CHUNK_SHIFT) | (c & CHUNK_MASK);
+    return (chunk->revealed[bit >> 3] >> (bit & 7)) & 1;
+}
+
+/* Returns 0 if the cell could not be revealed for lack of memory. */
+int set_revealed(Game *game, int r, int c, int value) {
+    TouchedChunk *chunk = find_touched_chunk(game, r >> CHUNK_SHIFT, c >> CHUNK_SHIFT, value);
+    if (!chunk) return !value;
+    int bit = ((r & CHUNK_MASK) << CHUNK_SHIFT) | (c & CHUNK_MASK);
+    if (((chunk->revealed[bit >> 3] >> (bit & 7)) & 1) == value) return 1;
+    if (value) {
+        chunk->revealed[bit >> 3] |= 1 << (bit & 7);
+        game->revealed_count++;
+    } else {
+        chunk->revealed[bit >> 3] &= ~(1 << (bit & 7));
+        game->revealed_count--;
+    }
+    return 1;
+}
+
+/* The allocating helpers below return 0 and leave the game as it was when memory runs out. */
+int push(Game *game, long long cell) {
+    if (game->fill_count == game->fill_capacity) {
+        long long capacity = game->fill_capacity ? game->fill_capacity * 2 : 1024;
+        long long *cells = realloc(game->fill_cells, capacity * sizeof(long long));
+        if (!cells) return 0;
+        game->fill_cells = cells;
+        game->fill_capacity = capacity;
+    }
+    game->fill_cells[game->fill_count++] = cell;
+    return 1;
+}
+
+/* Reveals a cell and adds it to the fill's work list, or leaves it hidden. */
+int reveal_and_push(Game *game, int r, int c) {
+    if (!set_revealed(game, r, c, 1)) return 0;
+    if (push(game, (long long)r * game->board_size + c)) return 1;
+    set_revealed(game, r, c, 0);
+    return 0;
+}
+
+int history_put(Game *game, unsigned char byte) {
+    long long block = game->history_bytes / HISTORY_BLOCK_BYTES;
+    if (block == game->history_block_count) {
+        unsigned char **blocks = realloc(game->history_blocks, (block + 1) * sizeof(unsigned char *));
+        if (!blocks) return 0;
+        game->history_blocks = blocks;
+        blocks[block] = malloc(HISTORY_BLOCK_BYTES);
+        if (!blocks[block]) return 0;
+        game->history_block_count++;
+    }
+    game->history_blocks[block][game->history_bytes % HISTORY_BLOCK_BYTES] = byte;
+    game->history_bytes++;
+    return 1;
+}
+
+int history_put_varint(Game *game, unsigned long long value) {
+    while (value >= 0x80) {
+        if (!history_put(game, (unsigned char)(value | 0x80))) return 0;
+        value >>= 7;
+    }
+    return history_put(game, (unsigned char)value);
+}
+
+unsigned long long history_get_varint(Game *game, long long *offset) {
+    unsigned long long value = 0;
+    int shift = 0;
+    unsigned char byte;
+    do {
+        byte = game->history_blocks[*offset / HISTORY_BLOCK_BYTES][*offset % HISTORY_BLOCK_BYTES];
+        value |= (unsigned long long)(byte & 0x7f) << shift;
+        shift += 7;
+        (*offset)++;
+    } while (byte & 0x80);
+    return value;
+}
+
+int compare_cells(const void *a, const void *b) {
+    long long x = *(const long long *)a;
+    long long y = *(const long long *)b;
+    return (x > y) - (x < y);
+}
+
+/* Starts a new group in the history, dropping any undone moves that could still have been redone. */
+int begin_group(Game *game) {
+    if (game->group_top == game->group_capacity) {
+        int capacity = game->group_capacity ? game->group_capacity * 2 : 256;
+        long long *offsets = realloc(game->group_offsets, capacity * sizeof(long long));
+        if (!offsets) return 0;
+        game->group_offsets = offsets;
+        game->group_capacity = capacity;
+    }
+    if (game->group_top < game->group_count) {
+        game->history_bytes = game->group_offsets[game->group_top];
+        game->group_count = game->group_top;
+    }
+    game->group_offsets[game->group_count++] = game->history_bytes;
+    game->group_top = game->group_count;
+    return 1;
+}
+
+/* Takes back a group that could not be written in full. */
+int drop_group(Game *game) {
+    game->group_top = --game->group_count;
+    game->history_bytes = game->group_offsets[game->group_count];
+    return 0;
+}
+
+/* A reveal group is stored as the runs of consecutive cell indices it covers, after sorting: twice the run
+   count, then for each run the gap since the end of the previous run and its length less one, all as
+   varints. An opened region is mostly whole row segments, so this costs a few bytes per row of it. */
+int record_group(Game *game, long long *cells, int count) {
+    int i, runs = 0;
+    long long previous_end = 0;
+
+    if (!begin_group(game)) return 0;
+    qsort(cells, count, sizeof(long long), compare_cells);
+    for (i = 0; i < count; i++) {
+        if (i == 0 || cells[i] != cells[i - 1] + 1) runs++;
+    }
+    if (!history_put_varint(game, (unsigned long long)runs << 1)) return drop_group(game);
+    for (i = 0; i < count; i++) {
+        int start = i;
+        while (i + 1 < count && cells[i + 1] == cells[i] + 1) i++;
+        if (!history_put_varint(game, cells[start] - previous_end) || !history_put_varint(game, i - start)) return drop_group(game);
+        previous_end = cells[i] + 1;
+    }
+    return 1;
+}
+
+/* A move that opened a whole labelled zero region is stored as just the region number, twice over plus one,
+   and replayed from the region's span. */
+int record_region(Game *game, int region) {
+    if (!begin_group(game)) return 0;
+    if (!history_put_varint(game, ((unsigned long long)region << 1) | 1)) return drop_group(game);
+    return 1;
+}
+
+void open_group(Game *game, GroupReader *reader, int group) {
+    reader->offset = game->group_offsets[group];
+    unsigned long long header = history_get_varint(game, &reader->offset);
+    reader->region = -1;
+    reader->runs_left = (long long)(header >> 1);
+    reader->cell = 0;
+    reader->run_end = 0;
+    if (header & 1) {
+        reader->region = (int)(header >> 1);
+        reader->runs_left = 0;
+        reader->cell = game->regions[reader->region].start;
+        reader->run_end = reader->cell + game->regions[reader->region].count;
+    }
+}
+
+int next_group_cell(Game *game, GroupReader *reader, long long *cell) {
+    if (reader->region >= 0) {
+        if (reader->cell == reader->run_end) return 0;
+        *cell = game->region_cells[reader->cell++];
+        return 1;
+    }
+    if (reader->cell == reader->run_end) {
+        if (reader->runs_left == 0) return 0;
+        reader->runs_left--;
+        reader->cell = reader->run_end + (long long)history_get_varint(game, &reader->offset);
+        reader->run_end = reader->cell + (long long)history_get_varint(game, &reader->offset) + 1;
+    }
+    *cell = reader->cell++;
+    return 1;
+}
+
+/* Undo and redo set or clear the revealed bits of one recorded group. Undone groups stay in the history
+   until a new move replaces them. */
+int apply_group(Game *game, int group, int value) {
+    GroupReader reader;
+    long long cell;
+    int count = 0;
+    open_group(game, &reader, group);
+    while (next_group_cell(game, &reader, &cell)) {
+        set_revealed(game, (int)(cell / game->board_size), (int)(cell % game->board_size), value);
+        count++;
+    }
+    return count;
+}
+
+int pop_group(Game *game) {
+    if (game->group_top <= 0) {
+        printf("No moves to undo!\n");
+        return 0;
+    }
+
+    int count = apply_group(game, --game->group_top, 0);
+    printf("Last move undone (%d cell%s).\n", count, count > 1 ? "s" : "");
+    return 1;
+}
+
+int redo_group(Game *game) {
+    if (game->group_top >= game->group_count) {
+        printf("No moves to redo!\n");
+        return 0;
+    }
+
+    int count = apply_group(game, game->group_top++, 1);
+    printf("Move redone (%d cell%s).\n", count, count > 1 ? "s" : "");
+    return 1;
+}
+
+int find_region_root(int *parent, int cell) {
+    while (parent[cell] != cell) {
+        parent[cell] = parent[parent[cell]];
+        cell = parent[cell];
+    }
+    return cell;
+}
+
+/* Zero regions next to a numbered cell, each listed once. The zeros around a cell can fall into at most
+   four regions. */
+int bordering_regions(Game *game, int r, int c, int found[4]) {
+    int dr, dc, i, count = 0;
+    for (dr = -1; dr <= 1; dr++) {
+        for (dc = -1; dc <= 1; dc++) {
+            int nr = r + dr;
+            int nc = c + dc;
+            if (nr < 0 || nr >= game->board_size || nc < 0 || nc >= game->board_size) continue;
+            int region = game->region_of[nr * game->board_size + nc];
+            if (region < 0) continue;
+            for (i = 0; i < count && found[i] != region; i++) {
+            }
+            if (i == count) found[count++] = region;
+        }
+    }
+    return count;
+}
+
+/* Counts every cell into the regions it belongs to: a zero into its own, a number into each region it
+   borders. With fill set the cells are also written into the spans, which then come out in cell order. */
+void add_region_cells(Game *game, int fill) {
+    int cells = game->board_size * game->board_size;
+    int i, k;
+    for (i = 0; i < cells; i++) {
+        int found[4];
+        int count = 1;
+        if (game->region_of[i] >= 0) {
+            found[0] = game->region_of[i];
+        } else {
+            count = bordering_regions(game, i / game->board_size, i % game->board_size, found);
+        }
+        for (k = 0; k < count; k++) {
+            Span *region = &game->regions[found[k]];
+            if (fill) game->region_cells[region->start + region->count] = i;
+            region->count++;
+        }
+    }
+}
+
+/* Labels the zero regions of a board of up to REGION_LABEL_SIZE a side, once, the first time a zero is
+   opened. Zero cells are found a chunk at a time, so each mine layout is loaded once, and then joined to
+   their zero neighbours above and to the left by union-find, always under the smaller root. Every parent
+   then precedes its child, so one pass in cell order turns roots into region numbers. Each region's span of
+   region_cells lists, in cell order, its zeros and the numbers around them: exactly what opening any of its
+   zeros reveals. Returns 0 and leaves the board unlabelled if there is not enough memory. */
+int label_regions(Game *game) {
+    int size = game->board_size;
+    int cells = size * size;
+    int *parent;
+    int chunk_row, chunk_col, r, c, i;
+
+    if (cells > game->region_of_capacity) {
+        free(game->region_of);
+        game->region_of = malloc(cells * sizeof(int));
+        game->region_of_capacity = game->region_of ? cells : 0;
+        if (!game->region_of) return 0;
+    }
+    parent = game->region_of;
+    for (chunk_row = 0; chunk_row << CHUNK_SHIFT < size; chunk_row++) {
+        for (chunk_col = 0; chunk_col << CHUNK_SHIFT < size; chunk_col++) {
+            MineChunk *chunk = load_mine_chunk(game, chunk_row, chunk_col);
+            for (r = 0; r < chunk_extent(game, chunk_row); r++) {
+                int *row = &parent[((chunk_row << CHUNK_SHIFT) + r) * size + (chunk_col << CHUNK_SHIFT)];
+                for (c = 0; c < chunk_extent(game, chunk_col); c++) {
+                    row[c] = !(chunk->mines[r] >> c & 1) && chunk->counts[r][c] == 0 ? (int)(&row[c] - parent) : -1;
+                }
+            }
+        }
+    }
+    for (r = 0; r < size; r++) {
+        for (c = 0; c < size; c++) {
+            int cell = r * size + c;
+            if (parent[cell] < 0) continue;
+            int neighbours[4] = { cell - 1, cell - size - 1, cell - size, cell - size + 1 };
+            int present[4] = { c > 0, r > 0 && c > 0, r > 0, r > 0 && c < size - 1 };
+            for (i = 0; i < 4; i++) {
+                if (!present[i] || parent[neighbours[i]] < 0) continue;
+                int a = find_region_root(parent, cell);
+                int b = find_region_root(parent, neighbours[i]);
+                if (a < b) parent[b] = a;
+                if (b < a) parent[a] = b;
+            }
+        }
+    }
+
+    game->region_count = 0;
+    for (i = 0; i < cells; i++) {
+        if (parent[i] < 0) continue;
+        if (parent[i] == i) {
+            if (game->region_count == game->region_capacity) {
+                int capacity = game->region_capacity ? game->region_capacity * 2 : 256;
+                Span *regions = realloc(game->regions, capacity * sizeof(Span));
+                if (!regions) return 0;
+                game->regions = regions;
+                game->region_capacity = capacity;
+            }
+            game->regions[game->region_count].start = 0;
+            game->regions[game->region_count].count = 0;
+            game->region_of[i] = game->region_count++;
+        } else {
+            game->region_of[i] = game->region_of[parent[i]];
+        }
+    }
+
+    int total = 0;
+    add_region_cells(game, 0);
+    for (i = 0; i < game->region_count; i++) {
+        game->regions[i].start = total;
+        total += game->regions[i].count;
+        game->regions[i].count = 0;
+    }
+    if (total > game->region_cells_capacity) {
+        free(game->region_cells);
+        game->region_cells = malloc(total * sizeof(int));
+        game->region_cells_capacity = game->region_cells ? total : 0;
+        if (!game->region_cells) return 0;
+    }
+    add_region_cells(game, 1);
+    game->regions_labelled = 1;
+    return 1;
+}
+
+/* A zero on a board small enough to label opens its region's span, unless labelling ran out of memory.
+   Otherwise this is breadth first over a
+   work list that is kept between calls, so nothing recurses and nothing is allocated once it has grown.
+   The returned span covers every cell this call opened, and fill_region names the region if it was opened
+   from its span. Running out of memory stops the fill with the cells opened so far. */
+Span flood_fill(Game *game, int r, int c) {
+    Span span;
+    int next, dr, dc, i, full = 0;
+
+    game->fill_count = 0;
+    game->fill_region = -1;
+    span.start = 0;
+    span.count = 0;
+    if (r < 0 || r >= game->board_size || c < 0 || c >= game->board_size || is_revealed(game, r, c)) return span;
+
+    if (game->board_size <= REGION_LABEL_SIZE && !is_mine(game, r, c) && count_mines(game, r, c) == 0 &&
+        (game->regions_labelled || label_regions(game))) {
+        Span region = game->regions[game->region_of[r * game->board_size + c]];
+        for (i = region.start; i < region.start + region.count; i++) {
+            int cell = game->region_cells[i];
+            if (is_revealed(game, cell / game->board_size, cell % game->board_size)) continue;
+            if (!reveal_and_push(game, cell / game->board_size, cell % game->board_size)) break;
+        }
+        game->fill_region = game->region_of[r * game->board_size + c];
+        span.count = game->fill_count;
+        return span;
+    }
+
+    reveal_and_push(game, r, c);
+
+    for (next = 0; next < game->fill_count && !full; next++) {
+        int cr = (int)(game->fill_cells[next] / game->board_size);
+        int cc = (int)(game->fill_cells[next] % game->board_size);
+        if (count_mines(game, cr, cc) != 0) continue;
+        for (dr = -1; dr <= 1 && !full; dr++) {
+            for (dc = -1; dc <= 1 && !full; dc++) {
+                int nr = cr + dr;
+                int nc = cc + dc;
+                if (nr >= 0 && nr < game->board_size && nc >= 0 && nc < game->board_size && !is_revealed(game, nr, nc)) {
+                    full = !reveal_and_push(game, nr, nc);
+                }
+            }
+        }
+    }
+
+    span.count = game->fill_count;
+    return span;
+}
+
+/* The view is VIEW_SIZE square, or on a terminal as much of the board as fits above MESSAGE_LINES lines
+   kept for prompts and messages. A change of either size makes the next frame start from a clear screen. */
+void size_view(Game *game) {
+    struct winsize terminal_size;
+    int height = VIEW_SIZE;
+    int width = VIEW_SIZE;
+    int rows = game->screen_rows;
+
+    if (game->terminal && ioctl(STDOUT_FILENO, TIOCGWINSZ, &terminal_size) == 0 && terminal_size.ws_row && terminal_size.ws_col) {
+        int label = snprintf(NULL, 0, "%d", game->board_size - 1);
+        height = terminal_size.ws_row - FRAME_HEADER_LINES - MESSAGE_LINES;
+        width = (terminal_size.ws_col - (label < 2 ? 2 : label) - 1) / 3;
+        rows = terminal_size.ws_row;
+    }
+    if (height > game->board_size) height = game->board_size;
+    if (width > game->board_size) width = game->board_size;
+    if (height < 1) height = 1;
+    if (width < 1) width = 1;
+    if (height != game->view_height || width != game->view_width || rows != game->screen_rows) game->screen_ready = 0;
+    game->view_height = height;
+    game->view_width = width;
+    game->screen_rows = rows;
+}
+
+void clamp_view(Game *game) {
+    if (game->view_row > game->board_size - game->view_height) game->view_row = game->board_size - game->view_height;
+    if (game->view_col > game->board_size - game->view_width) game->view_col = game->board_size - game->view_width;
+    if (game->view_row < 0) game->view_row = 0;
+    if (game->view_col < 0) game->view_col = 0;
+}
+
+void centre_view(Game *game, int row, int col) {
+    game->view_row = row - game->view_height / 2;
+    game->view_col = col - game->view_width / 2;
+    clamp_view(game);
+}
+
+/* Moves the view by half its size in each direction asked for. */
+void scroll_view(Game *game, int rows, int cols) {
+    game->view_row += rows * ((game->view_height + 1) / 2);
+    game->view_col += cols * ((game->view_width + 1) / 2);
+    clamp_view(game);
+}
+
+/* Index of the variable for a cell, or -1 if there is none, or if it could not be created. */
+int find_var(Game *game, long long cell, int create) {
+    int i;
+    if (create && (game->var_count + 1) * 2 > game->var_table_capacity) {
+        int capacity = game->var_table_capacity ? game->var_table_capacity * 2 : 1024;
+        int *slots = malloc(capacity * sizeof(int));
+        if (!slots) return -1;
+        free(game->var_slots);
+        game->var_slots = slots;
+        game->var_table_capacity = capacity;
+        memset(game->var_slots, 0xff, game->var_table_capacity * sizeof(int));
+        for (i = 0; i < game->var_count; i++) {
+            int slot = (int)(((uint64_t)game->variables[i].cell * 0x9E3779B97F4A7C15ULL) >> 32) & (game->var_table_capacity - 1);
+            while (game->var_slots[slot] >= 0) slot = (slot + 1) & (game->var_table_capacity - 1);
+            game->var_slots[slot] = i;
+        }
+    }
+    if (!game->var_table_capacity) return -1;
+
+    int slot = (int)(((uint64_t)cell * 0x9E3779B97F4A7C15ULL) >> 32) & (game->var_table_capacity - 1);
+    while (game->var_slots[slot] >= 0 && game->variables[game->var_slots[slot]].cell != cell) slot = (slot + 1) & (game->var_table_capacity - 1);
+    if (game->var_slots[slot] < 0) {
+        if (!create) return -1;
+        if (game->var_count == game->var_capacity) {
+            int capacity = game->var_capacity ? game->var_capacity * 2 : 512;
+            Variable *variables = realloc(game->variables, capacity * sizeof(Variable));
+            if (!variables) return -1;
+            game->variables = variables;
+            game->var_capacity = capacity;
+        }
+        memset(&game->variables[game->var_count], 0, sizeof(Variable));
+        game->variables[game->var_count].cell = cell;
+        game->var_slots[slot] = game->var_count++;
+    }
+    return game->var_slots[slot];
+}
+
+/* Every revealed number with unrevealed neighbours becomes a constraint. Only touched chunks can hold
+   revealed cells, so this walks their bits rather than the board. Returns 0 if memory ran out. */
+int collect_constraints(Game *game) {
+    int i, bit, dr, dc;
+
+    game->var_count = 0;
+    game->constraint_count = 0;
+    if (game->var_table_capacity) memset(game->var_slots, 0xff, game->var_table_capacity * sizeof(int));
+
+    for (i = 0; i < game->touched_capacity; i++) {
+        TouchedChunk *chunk = &game->touched_chunks[i];
+        if (!chunk->revealed) continue;
+        int base_row = (int)(chunk->key >> 32) << CHUNK_SHIFT;
+        int base_col = (int)(chunk->key & 0xFFFFFFFF) << CHUNK_SHIFT;
+        for (bit = 0; bit < CHUNK_SIZE * CHUNK_SIZE; bit++) {
+            if (!chunk->revealed[bit >> 3]) {
+                bit |= 7;
+                continue;
+            }
+            if (!(chunk->revealed[bit >> 3] >> (bit & 7) & 1)) continue;
+            int r = base_row + (bit >> CHUNK_SHIFT);
+            int c = base_col + (bit & CHUNK_MASK);
+            int mines = count_mines(game, r, c);
+            if (!mines) continue;
+
+            Constraint constraint;
+            constraint.var_count = 0;
+            constraint.mines = mines;
+            for (dr = -1; dr <= 1; dr++) {
+                for (dc = -1; dc <= 1; dc++) {
+                    int nr = r + dr;
+                    int nc = c + dc;
+                    if (nr >= 0 && nr < game->board_size && nc >= 0 && nc < game->board_size && !is_revealed(game, nr, nc)) {
+                        int var = find_var(game, (long long)nr * game->board_size + nc, 1);
+                        if (var < 0) return 0;
+                        constraint.vars[constraint.var_count++] = var;
+                    }
+                }
+            }
+            if (!constraint.var_count) continue;
+            if (game->constraint_count == game->constraint_capacity) {
+                int capacity = game->constraint_capacity ? game->constraint_capacity * 2 : 512;
+                Constraint *constraints = realloc(game->constraints, capacity * sizeof(Constraint));
+                if (!constraints) return 0;
+                game->constraints = constraints;
+                game->constraint_capacity = capacity;
+            }
+            game->constraints[game->constraint_count++] = constraint;
+        }
+    }
+
+    int *links = realloc(game->var_links, (game->constraint_count * 8 + 1) * sizeof(int));
+    if (!links) return 0;
+    game->var_links = links;
+    for (i = 0; i < game->constraint_count; i++) {
+        for (bit = 0; bit < game->constraints[i].var_count; bit++) game->variables[game->constraints[i].vars[bit]].link_count++;
+    }
+    int next = 0;
+    for (i = 0; i < game->var_count; i++) {
+        game->variables[i].first_link = next;
+        next += game->variables[i].link_count;
+        game->variables[i].link_count = 0;
+    }
+    for (i = 0; i < game->constraint_count; i++) {
+        for (bit = 0; bit < game->constraints[i].var_count; bit++) {
+            Variable *var = &game->variables[game->constraints[i].vars[bit]];
+            game->var_links[var->first_link + var->link_count++] = i;
+        }
+    }
+    return 1;
+}
+
+/* Unknown neighbours of a constraint and how many mines they still have to hold. */
+void constraint_status(Game *game, Constraint *constraint, int *unknown, int *mines_left) {
+    int i;
+    *unknown = 0;
+    *mines_left = constraint->mines;
+    for (i = 0; i < constraint->var_count; i++) {
+        int state = game->variables[constraint->vars[i]].state;
+        if (state == VAR_UNKNOWN) (*unknown)++;
+        if (state == VAR_MINE) (*mines_left)--;
+    }
+}
+
+int settle_vars(Game *game, Constraint *constraint, Constraint *except, int state) {
+    int i, j, changed = 0;
+    for (i = 0; i < constraint->var_count; i++) {
+        int v = constraint->vars[i];
+        if (game->variables[v].state != VAR_UNKNOWN) continue;
+        int shared = 0;
+        if (except) {
+            for (j = 0; j < except->var_count; j++) {
+                if (except->vars[j] == v) shared = 1;
+            }
+        }
+        if (!shared) {
+            game->variables[v].state = state;
+            changed = 1;
+        }
+    }
+    return changed;
+}
+
+/* Single constraint rules (no mines left means the rest is safe, as many mines as unknowns means they
+   are all mines) and the subset rule: when one constraint's unknowns are inside another's, the cells only
+   the larger one sees hold the difference of their mine counts. Repeats until nothing changes. */
+void deduce(Game *game) {
+    int changed = 1;
+    int a, i, k;
+
+    while (changed) {
+        changed = 0;
+        for (a = 0; a < game->constraint_count; a++) {
+            Constraint *first = &game->constraints[a];
+            int unknown_a, mines_a;
+            constraint_status(game, first, &unknown_a, &mines_a);
+            if (!unknown_a) continue;
+            if (mines_a == 0) {
+                changed |= settle_vars(game, first, NULL, VAR_SAFE);
+                continue;
+            }
+            if (mines_a == unknown_a) {
+                changed |= settle_vars(game, first, NULL, VAR_MINE);
+                continue;
+            }
+            for (i = 0; i < first->var_count; i++) {
+                Variable *var = &game->variables[first->vars[i]];
+                if (var->state != VAR_UNKNOWN) continue;
+                for (k = 0; k < var->link_count; k++) {
+                    Constraint *second = &game->constraints[game->var_links[var->first_link + k]];
+                    int unknown_b, mines_b, j, m, inside = 1;
+                    if (second == first) continue;
+                    constraint_status(game, second, &unknown_b, &mines_b);
+                    if (unknown_b <= unknown_a) continue;
+                    for (j = 0; j < first->var_count && inside; j++) {
+                        if (game->variables[first->vars[j]].state != VAR_UNKNOWN) continue;
+                        inside = 0;
+                        for (m = 0; m < second->var_count; m++) {
+                            if (second->vars[m] == first->vars[j]) inside = 1;
+                        }
+                    }
+                    if (!inside) continue;
+                    if (mines_b == mines_a) changed |= settle_vars(game, second, first, VAR_SAFE);
+                    else if (mines_b - mines_a == unknown_b - unknown_a) changed |= settle_vars(game, second, first, VAR_MINE);
+                }
+            }
+        }
+    }
+}
+
+/* Splits the unknown frontier into independent game->components by walking shared game->constraints breadth first.
+   The breadth-first order also keeps each component's variable order tight for the enumeration.
+   Returns 0 if memory ran out. */
+int split_components(Game *game) {
+    int i, k, j;
+    int var_top = 0;
+    int constraint_top = 0;
+    int *vars, *constraints, *component_of, *local;
+
+    /* Each array is stored as soon as it is grown, so a failure part way leaks nothing. */
+    if (!(vars = realloc(game->component_vars, (game->var_count + 1) * sizeof(int)))) return 0;
+    game->component_vars = vars;
+    if (!(constraints = realloc(game->component_constraints, (game->constraint_count + 1) * sizeof(int)))) return 0;
+    game->component_constraints = constraints;
+    if (!(component_of = realloc(game->constraint_component, (game->constraint_count + 1) * sizeof(int)))) return 0;
+    game->constraint_component = component_of;
+    if (!(local = realloc(game->constraint_local, (game->constraint_count + 1) * sizeof(int)))) return 0;
+    game->constraint_local = local;
+    for (i = 0; i < game->constraint_count; i++) game->constraint_component[i] = -1;
+    for (i = 0; i < game->var_count; i++) game->variables[i].component = -1;
+    game->component_count = 0;
+
+    for (i = 0; i < game->var_count; i++) {
+        if (game->variables[i].state != VAR_UNKNOWN || game->variables[i].component >= 0) continue;
+        if (game->component_count == game->component_capacity) {
+            int capacity = game->component_capacity ? game->component_capacity * 2 : 64;
+            Component *components = realloc(game->components, capacity * sizeof(Component));
+            if (!components) return 0;
+            game->components = components;
+            game->component_capacity = capacity;
+        }
+        Component *component = &game->components[game->component_count];
+        int next = var_top;
+        memset(component, 0, sizeof(Component));
+        component->vars = &game->component_vars[var_top];
+        component->constraints = &game->component_constraints[constraint_top];
+
+        game->variables[i].component = game->component_count;
+        game->component_vars[var_top++] = i;
+        for (; next < var_top; next++) {
+            Variable *var = &game->variables[game->component_vars[next]];
+            var->local = next - (int)(component->vars - game->component_vars);
+            for (k = 0; k < var->link_count; k++) {
+                int c = game->var_links[var->first_link + k];
+                if (game->constraint_component[c] >= 0) continue;
+                game->constraint_component[c] = game->component_count;
+                game->constraint_local[c] = constraint_top - (int)(component->constraints - game->component_constraints);
+                game->component_constraints[constraint_top++] = c;
+                for (j = 0; j < game->constraints[c].var_count; j++) {
+                    Variable *other = &game->variables[game->constraints[c].vars[j]];
+                    if (other->state == VAR_UNKNOWN && other->component < 0) {
+                        other->component = game->component_count;
+                        game->component_vars[var_top++] = game->constraints[c].vars[j];
+                    }
+                }
+            }
+        }
+        component->var_count = var_top - (int)(component->vars - game->component_vars);
+        component->constraint_count = constraint_top - (int)(component->constraints - game->component_constraints);
+        game->component_count++;
+    }
+    return 1;
+}
+
+typedef struct {
+    Component *component;
+    int *need;
+    int *unassigned;
+    int *mine_stack;
+    long long nodes;
+    int aborted;
+} Enumeration;
+
+/* Backtracking over the component's cells in order, pruning as soon as a constraint needs more mines than
+   it has cells left or has too many already. The cells holding mines on the current path are kept on a
+   stack, so a solution costs one step per mine rather than one per cell. */
+void enumerate(Game *game, Enumeration *e, int depth, int mines) {
+    Component *component = e->component;
+    int value, k, i;
+
+    if (e->aborted) return;
+    if (++e->nodes > ENUMERATION_LIMIT) {
+        e->aborted = 1;
+        return;
+    }
+    if (depth == component->var_count) {
+        component->solutions[mines] += 1;
+        for (i = 0; i < mines; i++) component->hits[e->mine_stack[i] * (component->var_count + 1) + mines] += 1;
+        return;
+    }
+
+    Variable *var = &game->variables[component->vars[depth]];
+    for (value = 0; value <= 1; value++) {
+        int feasible = 1;
+        for (k = 0; k < var->link_count; k++) {
+            int c = game->constraint_local[game->var_links[var->first_link + k]];
+            e->need[c] -= value;
+            e->unassigned[c]--;
+            if (e->need[c] < 0 || e->need[c] > e->unassigned[c]) feasible = 0;
+        }
+        e->mine_stack[mines] = depth;
+        if (feasible) enumerate(game, e, depth + 1, mines + value);
+        for (k = 0; k < var->link_count; k++) {
+            int c = game->constraint_local[game->var_links[var->first_link + k]];
+            e->need[c] += value;
+            e->unassigned[c]++;
+        }
+    }
+}
+
+/* A component too big to enumerate, or one there is no memory for, is left inexact and weighed like the
+   interior. */
+void enumerate_component(Game *game, Component *component) {
+    Enumeration e;
+    int i, unknown, mines_left;
+
+    component->exact = 0;
+    if (component->var_count > MAX_COMPONENT_VARS) return;
+
+    component->solutions = calloc(component->var_count + 1, sizeof(double));
+    component->hits = calloc((size_t)component->var_count * (component->var_count + 1), sizeof(double));
+    e.component = component;
+    e.need = malloc(component->constraint_count * sizeof(int));
+    e.unassigned = malloc(component->constraint_count * sizeof(int));
+    e.mine_stack = malloc(component->var_count * sizeof(int));
+    e.nodes = 0;
+    e.aborted = !component->solutions || !component->hits || !e.need || !e.unassigned || !e.mine_stack;
+    if (e.aborted) {
+        free(component->solutions);
+        free(component->hits);
+        component->solutions = NULL;
+        component->hits = NULL;
+        free(e.need);
+        free(e.unassigned);
+        free(e.mine_stack);
+        return;
+    }
+    for (i = 0; i < component->constraint_count; i++) {
+        constraint_status(game, &game->constraints[component->constraints[i]], &unknown, &mines_left);
+        e.need[i] = mines_left;
+        e.unassigned[i] = unknown;
+    }
+    enumerate(game, &e, 0, 0);
+    component->exact = !e.aborted;
+    free(e.need);
+    free(e.unassigned);
+    free(e.mine_stack);
+}
+
+void *enumeration_worker(void *arg) {
+    Game *game = arg;
+    int index;
+    while ((index = atomic_fetch_add(&game->next_component, 1)) < game->component_count) {
+        enumerate_component(game, &game->components[index]);
+    }
+    return NULL;
+}
+
+/* Components are independent, so they are enumerated on as many threads as there are cores. If a thread
+   cannot be started, this thread takes its share of the components. */
+void enumerate_components(Game *game) {
+    pthread_t threads[MAX_SOLVER_THREADS];
+    int thread_count = game->solver_threads > 0 ? game->solver_threads : (int)sysconf(_SC_NPROCESSORS_ONLN);
+    int started = 0;
+    int i;
+
+    if (thread_count > MAX_SOLVER_THREADS) thread_count = MAX_SOLVER_THREADS;
+    if (thread_count > game->component_count) thread_count = game->component_count;
+    atomic_store(&game->next_component, 0);
+    if (thread_count <= 1) {
+        enumeration_worker(game);
+        return;
+    }
+    while (started < thread_count && pthread_create(&threads[started], NULL, enumeration_worker, game) == 0) started++;
+    if (started < thread_count) enumeration_worker(game);
+    for (i = 0; i < started; i++) pthread_join(threads[i], NULL);
+}
+
+/* NULL if there is no memory for the result. */
+double *convolve(double *a, int a_size, double *b, int b_size) {
+    double *out = calloc(a_size + b_size - 1, sizeof(double));
+    double largest = 0;
+    int i, j;
+    if (!out) return NULL;
+    for (i = 0; i < a_size; i++) {
+        for (j = 0; j < b_size; j++) out[i + j] += a[i] * b[j];
+    }
+    for (i = 0; i < a_size + b_size - 1; i++) {
+        if (out[i] > largest) largest = out[i];
+    }
+    if (largest > 0) {
+        for (i = 0; i < a_size + b_size - 1; i++) out[i] /= largest;
+    }
+    return out;
+}
+
+/* Exact weighing for weigh_components: the frontier's mine count distribution is the convolution of the
+   components', and each component sees the convolution of all the others through prefix and suffix
+   products. Returns 0 if memory runs out, leaving the approximation to weigh_components. */
+int convolve_components(Game *game, double interior, double mines_left, int frontier, double *interior_mines) {
+    double *weights = malloc((frontier + 1) * sizeof(double));
+    double **prefix = calloc(game->component_count + 1, sizeof(double *));
+    int *prefix_size = malloc((game->component_count + 1) * sizeof(int));
+    double *suffix = calloc(1, sizeof(double));
+    double best = -INFINITY;
+    double log_weight = 0;
+    int suffix_size = 1;
+    int ok = weights && prefix && prefix_size && suffix && (prefix[0] = calloc(1, sizeof(double)));
+    int c, i, m, k;
+
+    for (k = 0; ok && k <= frontier; k++) {
+        if (mines_left - k < 0 || mines_left - k > interior) {
+            weights[k] = -INFINITY;
+            log_weight = 0;
+            continue;
+        }
+        if (k > 0 && weights[k - 1] != -INFINITY) log_weight += log(mines_left - k + 1) - log(interior - mines_left + k);
+        weights[k] = log_weight;
+        if (weights[k] > best) best = weights[k];
+    }
+    for (k = 0; ok && k <= frontier; k++) weights[k] = best == -INFINITY ? 0 : exp(weights[k] - best);
+
+    if (ok) {
+        prefix[0][0] = 1;
+        prefix_size[0] = 1;
+    }
+    for (c = 0; ok && c < game->component_count; c++) {
+        Component *component = &game->components[c];
+        if (component->exact) {
+            prefix[c + 1] = convolve(prefix[c], prefix_size[c], component->solutions, component->var_count + 1);
+            prefix_size[c + 1] = prefix_size[c] + component->var_count;
+        } else {
+            prefix[c + 1] = convolve(prefix[c], prefix_size[c], prefix[0], 1);
+            prefix_size[c + 1] = prefix_size[c];
+        }
+        ok = prefix[c + 1] != NULL;
+    }
+
+    double total = 0;
+    *interior_mines = 0;
+    for (k = 0; ok && k < prefix_size[game->component_count]; k++) {
+        total += prefix[game->component_count][k] * weights[k];
+        *interior_mines += prefix[game->component_count][k] * weights[k] * (mines_left - k);
+    }
+    *interior_mines = total > 0 ? *interior_mines / total : 0;
+
+    if (ok) suffix[0] = 1;
+    for (c = game->component_count - 1; ok && c >= 0; c--) {
+        Component *component = &game->components[c];
+        if (!component->exact) continue;
+        int size = component->var_count + 1;
+        double *others = convolve(prefix[c], prefix_size[c], suffix, suffix_size);
+        int others_size = prefix_size[c] + suffix_size - 1;
+        double *reach = calloc(size, sizeof(double));
+        double *next_suffix = convolve(suffix, suffix_size, component->solutions, size);
+        double norm = 0;
+        if (!others || !reach || !next_suffix) {
+            free(others);
+            free(reach);
+            free(next_suffix);
+            ok = 0;
+            break;
+        }
+        for (m = 0; m < size; m++) {
+            for (k = 0; k < others_size; k++) reach[m] += others[k] * weights[k + m];
+            norm += component->solutions[m] * reach[m];
+        }
+        for (i = 0; i < component->var_count; i++) {
+            double hit = 0;
+            for (m = 0; m < size; m++) hit += component->hits[i * size + m] * reach[m];
+            game->variables[component->vars[i]].probability = norm > 0 ? hit / norm : 0.5;
+        }
+        free(suffix);
+        suffix = next_suffix;
+        suffix_size += component->var_count;
+        free(others);
+        free(reach);
+    }
+
+    if (prefix) {
+        for (c = 0; c <= game->component_count; c++) free(prefix[c]);
+    }
+    free(prefix);
+    free(prefix_size);
+    free(suffix);
+    free(weights);
+    return ok;
+}
+
+/* Turns the per-component solution counts into mine probabilities. A way of putting k mines on the
+   enumerated frontier leaves the rest to fall anywhere in the unconstrained interior, so it is weighted by
+   C(interior, mines_left - k). The weights are built as running ratios in log space because the interior
+   can be far too big for the binomials themselves. When there are too many game->components to convolve, or
+   no memory to do it, the ratio between neighbouring weights is treated as constant, which makes the
+   game->components independent. Returns the mine probability of an interior cell. */
+double weigh_components(Game *game, double interior, double mines_left) {
+    int frontier = 0;
+    int c, i, m;
+    double interior_mines;
+
+    for (c = 0; c < game->component_count; c++) {
+        if (game->components[c].exact) frontier += game->components[c].var_count;
+    }
+
+    if ((double)frontier * game->component_count > MAX_CONVOLUTION_WORK ||
+        !convolve_components(game, interior, mines_left, frontier, &interior_mines)) {
+        double ratio = interior > mines_left ? mines_left / (interior - mines_left + 1) : 1e9;
+        double frontier_mines = 0;
+        for (c = 0; c < game->component_count; c++) {
+            Component *component = &game->components[c];
+            int size = component->var_count + 1;
+            double scale = 1, norm = 0, expected = 0;
+            if (!component->exact) continue;
+            for (m = 0; m < size; m++) {
+                norm += component->solutions[m] * scale;
+                expected += component->solutions[m] * scale * m;
+                for (i = 0; i < component->var_count; i++) {
+                    if (m == 0) game->variables[component->vars[i]].probability = 0;
+                    game->variables[component->vars[i]].probability += component->hits[i * size + m] * scale;
+                }
+                scale *= ratio;
+            }
+            for (i = 0; i < component->var_count; i++) game->variables[component->vars[i]].probability /= norm > 0 ? norm : 1;
+            frontier_mines += norm > 0 ? expected / norm : 0;
+        }
+        interior_mines = mines_left - frontier_mines;
+    }
+
+    return interior > 0 ? interior_mines / interior : 1;
+}
+
+/* Nearest unknown cell off the frontier, searched in growing rings around the middle of the view. */
+int find_interior_cell(Game *game, int *row, int *col) {
+    int centre_row = game->view_row + game->view_height / 2;
+    int centre_col = game->view_col + game->view_width / 2;
+    int radius, dr, dc;
+
+    for (radius = 0; radius < game->board_size; radius++) {
+        for (dr = -radius; dr <= radius; dr++) {
+            for (dc = -radius; dc <= radius; dc++) {
+                int r = centre_row + dr;
+                int c = centre_col + dc;
+                if (dr != -radius && dr != radius && dc != -radius && dc != radius) continue;
+                if (r < 0 || r >= game->board_size || c < 0 || c >= game->board_size || is_revealed(game, r, c)) continue;
+                if (find_var(game, (long long)r * game->board_size + c, 0) >= 0) continue;
+                *row = r;
+                *col = c;
+                return 1;
+            }
+        }
+    }
+    return 0;
+}
+
+/* Solves the board the player can see. Fills in every cell that is certainly safe, or when there is none
+   the cell least likely to be a mine. Enumeration is only needed when deduction finds no safe cell.
+   Returns 0, with no safe cell and no guess, if there was not enough memory to work anything out. */
+int solve_board(Game *game, Solution *solution) {
+    int i, c;
+    int known_mines = 0;
+    int known_safe = 0;
+    int approximate = 0;
+
+    solution->safe_cells = NULL;
+    solution->safe_count = 0;
+    solution->mine_count = 0;
+    solution->guess_probability = 2;
+    game->component_count = 0;
+    if (!collect_constraints(game)) return 0;
+    deduce(game);
+    for (i = 0; i < game->var_count; i++) {
+        if (game->variables[i].state == VAR_MINE) known_mines++;
+        if (game->variables[i].state == VAR_SAFE) known_safe++;
+        game->variables[i].probability = game->variables[i].state == VAR_MINE ? 1 : game->variables[i].state == VAR_SAFE ? 0 : 0.5;
+    }
+    if (!known_safe) {
+        if (!split_components(game)) {
+            game->component_count = 0;
+            return 0;
+        }
+        enumerate_components(game);
+    }
+    for (c = 0; c < game->component_count; c++) {
+        if (!game->components[c].exact) approximate += game->components[c].var_count;
     }
-}
 
-void pop_group() {
-    int i;
-    if (move_history_top <= 0) {
-        printf("No moves to undo!\n");
-        return;
+    double unknown = (double)game->board_size * game->board_size - game->revealed_count;
+    double interior = unknown - game->var_count + approximate;
+    double interior_probability = known_safe ? 1 : weigh_components(game, interior, (double)(game->total_mines - known_mines));
+    for (c = 0; c < game->component_count; c++) {
+        if (game->components[c].exact) continue;
+        for (i = 0; i < game->components[c].var_count; i++) game->variables[game->components[c].vars[i]].probability = interior_probability;
     }
 
-    int count = push_count[--move_history_top];
-    for (i = 0; i < count; i++) {
-        if (move_top > 0) {
-            move_top--;
-            int r = move_rows[move_top];
-            int c = move_cols[move_top];
-            revealed[r][c] = 0;
+    solution->safe_cells = malloc((game->var_count + 1) * sizeof(long long));
+    for (i = 0; solution->safe_cells && i < game->var_count; i++) {
+        Variable *var = &game->variables[i];
+        if (var->state == VAR_SAFE || var->probability < 1e-12) {
+            solution->safe_cells[solution->safe_count++] = var->cell;
+        } else if (var->state == VAR_MINE || var->probability > 1 - 1e-12) {
+            solution->mine_count++;
+        } else if (var->probability < solution->guess_probability) {
+            solution->guess_probability = var->probability;
+            solution->guess_row = (int)(var->cell / game->board_size);
+            solution->guess_col = (int)(var->cell % game->board_size);
         }
     }
-    printf("Last move undone (%d cell%s).\n", count, count > 1 ? "s" : "");
+    if (interior - approximate > 0.5 && interior_probability < solution->guess_probability) {
+        if (find_interior_cell(game, &solution->guess_row, &solution->guess_col)) solution->guess_probability = interior_probability;
+    }
+
+    for (c = 0; c < game->component_count; c++) {
+        free(game->components[c].solutions);
+        free(game->components[c].hits);
+    }
+    return solution->safe_cells != NULL;
 }
 
-int count_mines(int r, int c) {
-    int count = 0;
-    int dr, dc;
-    for (dr = -1; dr <= 1; dr++) {
-        for (dc = -1; dc <= 1; dc++) {
-            int nr = r + dr;
-            int nc = c + dc;
-            if (nr >= 0 && nr < board_size && nc >= 0 && nc < board_size) {
-                if (mine_board[nr][nc]) count++;
+int row_label_width(Game *game) {
+    int width = snprintf(NULL, 0, "%d", game->board_size - 1);
+    return width < 2 ? 2 : width;
+}
+
+/* Glyphs of one row of the view. Each chunk is looked up once for the cells of the row that fall in it, and
+   its mine layout only if one of those cells is on show. */
+void view_row_glyphs(Game *game, int row, int show_all, char *glyphs) {
+    int col = game->view_col;
+    int end = game->view_col + game->view_width;
+    int r = row & CHUNK_MASK;
+
+    while (col < end) {
+        int chunk_end = ((col >> CHUNK_SHIFT) + 1) << CHUNK_SHIFT;
+        TouchedChunk *touched = find_touched_chunk(game, row >> CHUNK_SHIFT, col >> CHUNK_SHIFT, 0);
+        MineChunk *chunk = NULL;
+        if (chunk_end > end) chunk_end = end;
+        for (; col < chunk_end; col++) {
+            int c = col & CHUNK_MASK;
+            int bit = (r << CHUNK_SHIFT) | c;
+            if (!show_all && !(touched && (touched->revealed[bit >> 3] >> (bit & 7) & 1))) {
+                *glyphs++ = '#';
+                continue;
             }
+            if (!chunk) chunk = load_mine_chunk(game, row >> CHUNK_SHIFT, col >> CHUNK_SHIFT);
+            *glyphs++ = chunk->mines[r] >> c & 1 ? '*' : '0' + chunk->counts[r][c];
         }
     }
-    return count;
 }
 
-int flood_fill(int r, int c) {
-    if (r < 0 || r >= board_size || c < 0 || c >= board_size || revealed[r][c]) return 0;
+/* The frame buffer and the glyphs on screen are sized for the largest frame the view can need: every cell
+   redrawn with its own cursor move. Returns 0 if either could not be allocated; frame_printf still works
+   then, growing the buffer as it goes or cutting the text short. */
+int reserve_frame(Game *game) {
+    int label = row_label_width(game);
+    int cells = game->view_height * game->view_width;
+    int capacity = 256 + (game->view_height + FRAME_HEADER_LINES) * (label + 32 + 3 * game->view_width) + cells * 26;
+    int reserved = 1;
+
+    if (capacity > game->frame_capacity) {
+        free(game->frame);
+        game->frame = malloc(capacity);
+        game->frame_capacity = game->frame ? capacity : 0;
+        if (!game->frame) reserved = 0;
+    }
+    if (cells > game->shown_capacity) {
+        free(game->shown);
+        free(game->row_glyphs);
+        game->shown = malloc(cells);
+        game->row_glyphs = malloc(cells);
+        game->shown_capacity = cells;
+        if (!game->shown || !game->row_glyphs) {
+            free(game->shown);
+            free(game->row_glyphs);
+            game->shown = NULL;
+            game->row_glyphs = NULL;
+            game->shown_capacity = 0;
+            reserved = 0;
+        }
+    }
+    game->frame_length = 0;
+    return reserved;
+}
 
-    revealed[r][c] = 1;
-    push(r, c);
-    int opened = 1;
+/* A frame that outgrows reserve_frame's estimate grows the buffer and prints again. If that fails the text
+   is cut short, so frame_length never passes the end of the buffer. */
+void frame_printf(Game *game, const char *format, ...) {
+    va_list args, retry;
+    int room = game->frame_capacity - game->frame_length;
+    int length;
 
-    if (count_mines(r, c) == 0) {
-        int dr, dc;
-        for (dr = -1; dr <= 1; dr++) {
-            for (dc = -1; dc <= 1; dc++) {
-                if (dr != 0 || dc != 0)
-                    opened += flood_fill(r + dr, c + dc);
-            }
+    va_start(args, format);
+    va_copy(retry, args);
+    length = vsnprintf(game->frame + game->frame_length, room, format, args);
+    if (length >= room) {
+        int capacity = game->frame_capacity * 2 > game->frame_length + length + 1 ? game->frame_capacity * 2 : game->frame_length + length + 1;
+        char *frame = realloc(game->frame, capacity);
+        if (frame) {
+            game->frame = frame;
+            game->frame_capacity = capacity;
+            length = vsnprintf(game->frame + game->frame_length, capacity - game->frame_length, format, retry);
+        } else {
+            length = room - 1;
         }
     }
+    if (length > 0) game->frame_length += length;
+    va_end(retry);
+    va_end(args);
+}
+
+/* Anything printf still holds goes out first, then the whole frame in one write. */
+void flush_frame(Game *game) {
+    int written = 0;
+    fflush(stdout);
+    while (written < game->frame_length) {
+        ssize_t count = write(STDOUT_FILENO, game->frame + written, game->frame_length - written);
+        if (count <= 0) break;
+        written += (int)count;
+    }
+    game->frame_length = 0;
+}
+
+/* Without a terminal the view is printed whole, as plain lines. Column headings show the last two digits of
+   the column number. */
+void print_plain_board(Game *game, int show_all) {
+    int label = row_label_width(game);
+    int i, j;
+
+    if (!game->row_glyphs) {
+        frame_printf(game, "\nNot enough memory to draw the board.\n");
+        return;
+    }
+    if (game->view_height < game->board_size || game->view_width < game->board_size) {
+        frame_printf(game, "\nRows %d-%d, columns %d-%d of %d", game->view_row, game->view_row + game->view_height - 1, game->view_col,
+                     game->view_col + game->view_width - 1, game->board_size);
+    }
+    frame_printf(game, "\n%*s", label + 2, "");
+    for (j = 0; j < game->view_width; j++) frame_printf(game, "%2d ", (game->view_col + j) % 100);
+    frame_printf(game, "\n%*s", label + 1, "");
+    for (j = 0; j < game->view_width; j++) frame_printf(game, "---");
+    frame_printf(game, "\n");
 
-    return opened;
+    for (i = 0; i < game->view_height; i++) {
+        view_row_glyphs(game, game->view_row + i, show_all, game->row_glyphs);
+        frame_printf(game, "%*d|", label, game->view_row + i);
+        for (j = 0; j < game->view_width; j++) frame_printf(game, " %c ", game->row_glyphs[j]);
+        frame_printf(game, "\n");
+    }
 }
 
-void print_board(int show_all) {
+/* On a terminal the board stays at the top of the screen and everything else scrolls in the region below
+   it. Only cells whose glyph changed since the last frame are sent, each with a cursor move unless it
+   directly follows the previous one. A new view origin rewrites the headings and every cell, and a new view
+   size or terminal size clears the screen first. */
+void print_board(Game *game, int show_all) {
+    int label = row_label_width(game);
     int i, j;
 
-    printf("\n    ");
-    for (i = 0; i < board_size; i++) {
-        printf("%2d ", i);
+    size_view(game);
+    clamp_view(game);
+    /* Without the frame's buffers the differential frame cannot be drawn, so the view is printed whole and
+       the next frame that can be drawn starts from a clear screen. */
+    if (!reserve_frame(game) || !game->terminal) {
+        game->screen_ready = 0;
+        print_plain_board(game, show_all);
+        flush_frame(game);
+        return;
     }
-    printf("\n");
 
-    printf("   ");
-    for (i = 0; i < board_size; i++) {
-        printf("---");
+    int full = !game->screen_ready;
+    frame_printf(game, full ? "\x1b[r\x1b[H\x1b[2J" : "\x1b" "7");
+    if (full || game->view_row != game->shown_row || game->view_col != game->shown_col) {
+        memset(game->shown, 0, game->view_height * game->view_width);
+        frame_printf(game, "\x1b[1;1H\x1b[K");
+        if (game->view_height < game->board_size || game->view_width < game->board_size) {
+            frame_printf(game, "Rows %d-%d, columns %d-%d of %d (w/a/s/d to scroll)", game->view_row, game->view_row + game->view_height - 1,
+                         game->view_col, game->view_col + game->view_width - 1, game->board_size);
+        }
+        frame_printf(game, "\x1b[2;1H%*s", label + 2, "");
+        for (j = 0; j < game->view_width; j++) frame_printf(game, "%2d ", (game->view_col + j) % 100);
+        frame_printf(game, "\x1b[3;1H%*s", label + 1, "");
+        for (j = 0; j < game->view_width; j++) frame_printf(game, "---");
+        for (i = 0; i < game->view_height; i++) frame_printf(game, "\x1b[%d;1H%*d|", FRAME_HEADER_LINES + 1 + i, label, game->view_row + i);
+        game->shown_row = game->view_row;
+        game->shown_col = game->view_col;
     }
-    printf("\n");
 
-    for (i = 0; i < board_size; i++) {
-        printf("%2d|", i);
-        for (j = 0; j < board_size; j++) {
-            if (revealed[i][j] || show_all) {
-                if (mine_board[i][j]) {
-                    printf(" * ");
-                } else {
-                    int mines = count_mines(i, j);
-                    printf(" %d ", mines);
-                }
+    for (i = 0; i < game->view_height; i++) {
+        char *shown = game->shown + i * game->view_width;
+        int last = -2;
+        view_row_glyphs(game, game->view_row + i, show_all, game->row_glyphs);
+        for (j = 0; j < game->view_width; j++) {
+            if (game->row_glyphs[j] == shown[j]) continue;
+            if (last == j - 1) {
+                frame_printf(game, "  %c", game->row_glyphs[j]);
             } else {
-                printf(" # ");
+                frame_printf(game, "\x1b[%d;%dH%c", FRAME_HEADER_LINES + 1 + i, label + 3 + 3 * j, game->row_glyphs[j]);
             }
+            shown[j] = game->row_glyphs[j];
+            last = j;
         }
-        printf("\n");
     }
+
+    if (full) {
+        int first_line = FRAME_HEADER_LINES + game->view_height + 1;
+        frame_printf(game, "\x1b[%d;%dr\x1b[%d;1H", first_line, game->screen_rows, first_line);
+        game->screen_ready = 1;
+    } else {
+        frame_printf(game, "\x1b" "8");
+    }
+    flush_frame(game);
 }
 
-void save_map() {
+/* Hands the whole screen back to the terminal and leaves the cursor on its last line. */
+void close_screen(Game *game) {
+    if (!game->terminal || !game->screen_ready) return;
+    printf("\x1b[r\x1b[%d;1H\n", game->screen_rows);
+    fflush(stdout);
+    game->screen_ready = 0;
+}
+
+void save_map(Game *game) {
     FILE *fp = fopen("map.txt", "w");
     int i, j;
-    for (i = 0; i < board_size; i++) {
-        for (j = 0; j < board_size; j++) {
-            if (mine_board[i][j]) {
+    if (game->board_size > MAX_SAVED_MAP) {
+        fprintf(fp, "Seed %llu, size %d, %lld mines\n", (unsigned long long)game->board_seed, game->board_size, game->total_mines);
+        fclose(fp);
+        return;
+    }
+    for (i = 0; i < game->board_size; i++) {
+        for (j = 0; j < game->board_size; j++) {
+            if (is_mine(game, i, j)) {
                 fprintf(fp, "* ");
             } else {
                 fprintf(fp, ". ");
@@ -127,83 +1681,1060 @@ void save_map() {
     fclose(fp);
 }
 
-void save_moves() {
+void save_moves(Game *game) {
     FILE *fp = fopen("moves.txt", "w");
     fprintf(fp, "--- Game Moves ---\n");
-    int move_number = 1;
-    int index = 0;
-    int i, j;
-    for (i = 0; i < move_history_top; i++) {
-        fprintf(fp, "Move %d:\n", move_number++);
-        for (j = 0; j < push_count[i]; j++) {
-            fprintf(fp, "    (Row %d, Col %d)\n", move_rows[index], move_cols[index]);
-            index++;
+    int i;
+    for (i = 0; i < game->group_top; i++) {
+        GroupReader reader;
+        long long cell;
+        fprintf(fp, "Move %d:\n", i + 1);
+        open_group(game, &reader, i);
+        while (next_group_cell(game, &reader, &cell)) {
+            fprintf(fp, "    (Row %lld, Col %lld)\n", cell / game->board_size, cell % game->board_size);
         }
     }
-    fprintf(fp, "Total Moves: %d\n", move_history_top);
+    fprintf(fp, "Total Moves: %d\n", game->group_top);
     fclose(fp);
 }
 
-void generate_board() {
-    srand(time(NULL));
-    board_size = 2 + rand() % 9;
-    int num_mines = board_size;
-    int placed = 0;
-    while (placed < num_mines) {
-        int r = rand() % board_size;
-        int c = rand() % board_size;
-        if (!mine_board[r][c]) {
-            mine_board[r][c] = 1;
-            placed++;
+/* Forgets everything about the previous board so the game can be played again. The mine cache is sized to
+   the board, so small boards stay small. Returns 0 if there is no memory for the cache, and the game must
+   not be played until a later call succeeds. */
+int setup_board(Game *game, int size, long long mines, uint64_t seed) {
+    int i;
+    long long chunks_per_side = ((long long)size + CHUNK_SIZE - 1) >> CHUNK_SHIFT;
+    for (i = 0; i < game->touched_capacity; i++) free(game->touched_chunks[i].revealed);
+    if (game->touched_capacity) memset(game->touched_chunks, 0, game->touched_capacity * sizeof(TouchedChunk));
+    game->touched_count = 0;
+    game->last_touched_chunk = NULL;
+    game->mine_cache_used = 0;
+    game->mine_cache_newest = -1;
+    game->mine_cache_oldest = -1;
+    game->last_mine_chunk = NULL;
+    game->mine_cache_capacity = chunks_per_side * chunks_per_side < MINE_CACHE_CHUNKS ? (int)(chunks_per_side * chunks_per_side) : MINE_CACHE_CHUNKS;
+    if (game->mine_cache_capacity > game->mine_cache_allocated) {
+        free(game->mine_cache);
+        free(game->mine_cache_bucket);
+        game->mine_cache = malloc(game->mine_cache_capacity * sizeof(MineChunk));
+        game->mine_cache_allocated = game->mine_cache_capacity;
+        game->mine_cache_bucket_bits = 1;
+        while ((1 << game->mine_cache_bucket_bits) < game->mine_cache_capacity * 2) game->mine_cache_bucket_bits++;
+        game->mine_cache_bucket = malloc((1 << game->mine_cache_bucket_bits) * sizeof(int));
+        if (!game->mine_cache || !game->mine_cache_bucket) {
+            free(game->mine_cache);
+            free(game->mine_cache_bucket);
+            game->mine_cache = NULL;
+            game->mine_cache_bucket = NULL;
+            game->mine_cache_allocated = 0;
+            return 0;
+        }
+    }
+    memset(game->mine_cache_bucket, 0xff, (1 << game->mine_cache_bucket_bits) * sizeof(int));
+    game->revealed_count = 0;
+    game->history_bytes = 0;
+    game->group_count = 0;
+    game->group_top = 0;
+    game->regions_labelled = 0;
+    game->game_over = 0;
+
+    game->board_size = size;
+    game->total_mines = mines;
+    game->mine_density = (double)mines / ((double)size * size);
+    game->board_seed = seed;
+    game->screen_ready = 0;
+    size_view(game);
+    centre_view(game, 0, 0);
+    return 1;
+}
+
+long long board_mines(int size, double density) {
+    return llround(density * size * size);
+}
+
+/* Nothing is placed up front: chunks are generated from the seed the first time they are looked at, so
+   the same seed and parameters always give the same board. The classic random board has one mine per row;
+   a board of a chosen size uses DEFAULT_DENSITY unless a density or mine count is given. Returns 0 if there
+   is no memory for the board. */
+int generate_board(Game *game, int size, double density, long long mines, uint64_t seed) {
+    srand((unsigned)seed);
+    if (size <= 0) {
+        size = CLASSIC_MIN_SIZE + rand() % (CLASSIC_MAX_SIZE - CLASSIC_MIN_SIZE + 1);
+        if (density <= 0 && mines <= 0) mines = size;
+    }
+    if (mines <= 0) mines = board_mines(size, density > 0 ? density : DEFAULT_DENSITY);
+    if (!setup_board(game, size, mines, seed)) return 0;
+    save_map(game);
+    return 1;
+}
+
+void init_pool(GamePool *pool) {
+    memset(pool, 0, sizeof(GamePool));
+    pthread_mutex_init(&pool->lock, NULL);
+}
+
+/* NULL if the pool is empty and there is no memory for another slab. */
+Game *acquire_game(GamePool *pool) {
+    Game *game;
+    int i;
+
+    pthread_mutex_lock(&pool->lock);
+    if (!pool->free_games) {
+        Game **slabs = realloc(pool->slabs, (pool->slab_count + 1) * sizeof(Game *));
+        Game *slab = slabs ? calloc(GAME_SLAB_SIZE, sizeof(Game)) : NULL;
+        if (slabs) pool->slabs = slabs;
+        if (!slab) {
+            pthread_mutex_unlock(&pool->lock);
+            return NULL;
+        }
+        pool->slabs[pool->slab_count++] = slab;
+        for (i = GAME_SLAB_SIZE - 1; i >= 0; i--) {
+            slab[i].next_free = pool->free_games;
+            pool->free_games = &slab[i];
+        }
+    }
+    game = pool->free_games;
+    pool->free_games = game->next_free;
+    game->next_free = NULL;
+    pool->live_games++;
+    pthread_mutex_unlock(&pool->lock);
+    return game;
+}
+
+void release_game(GamePool *pool, Game *game) {
+    int i;
+    for (i = 0; i < game->touched_capacity; i++) free(game->touched_chunks[i].revealed);
+    if (game->touched_capacity) memset(game->touched_chunks, 0, game->touched_capacity * sizeof(TouchedChunk));
+    game->touched_count = 0;
+    game->last_touched_chunk = NULL;
+    game->solver_threads = 0;
+    game->terminal = 0;
+    game->screen_ready = 0;
+
+    pthread_mutex_lock(&pool->lock);
+    game->next_free = pool->free_games;
+    pool->free_games = game;
+    pool->live_games--;
+    pthread_mutex_unlock(&pool->lock);
+}
+
+void free_pool(GamePool *pool) {
+    int s, i;
+    for (s = 0; s < pool->slab_count; s++) {
+        for (i = 0; i < GAME_SLAB_SIZE; i++) {
+            Game *game = &pool->slabs[s][i];
+            int t;
+            for (t = 0; t < game->touched_capacity; t++) free(game->touched_chunks[t].revealed);
+            free(game->touched_chunks);
+            for (t = 0; t < game->history_block_count; t++) free(game->history_blocks[t]);
+            free(game->history_blocks);
+            free(game->group_offsets);
+            free(game->fill_cells);
+            free(game->region_of);
+            free(game->regions);
+            free(game->region_cells);
+            free(game->mine_cache);
+            free(game->mine_cache_bucket);
+            free(game->variables);
+            free(game->var_slots);
+            free(game->var_links);
+            free(game->constraints);
+            free(game->constraint_component);
+            free(game->constraint_local);
+            free(game->components);
+            free(game->component_vars);
+            free(game->component_constraints);
+            free(game->shown);
+            free(game->row_glyphs);
+            free(game->frame);
         }
+        free(pool->slabs[s]);
     }
-    save_map();
+    free(pool->slabs);
+    pthread_mutex_destroy(&pool->lock);
 }
 
-void gameOver(int row, int col) {
-    game_over = 1;
-    revealed[row][col] = 1;
+void gameOver(Game *game) {
     printf("\nBOOM! You hit a mine. Game Over.\n");
-    print_board(0);
+    print_board(game, 0);
+}
+
+int board_cleared(Game *game) {
+    return game->revealed_count == (long long)game->board_size * game->board_size - game->total_mines;
+}
+
+/* Every game played is appended to a binary log as it happens. A game starts with LOG_MAGIC, a version byte,
+   the seed as eight little-endian bytes, and the board size and mine count as varints, which is all it
+   takes to rebuild the board. Each event follows as one varint: the low two bits give its kind and the rest
+   the cell opened, or for LOG_END how the game ended. A move costs two to four bytes on a classic board. */
+void log_varint(FILE *fp, unsigned long long value) {
+    while (value >= 0x80) {
+        putc((int)(value | 0x80) & 0xff, fp);
+        value >>= 7;
+    }
+    putc((int)value, fp);
+}
+
+void open_log(Game *game, const char *path) {
+    int i;
+    game->log = fopen(path, "ab");
+    if (!game->log) {
+        printf("Could not open %s, this game will not be logged.\n", path);
+        return;
+    }
+    fwrite(LOG_MAGIC, 1, 4, game->log);
+    putc(LOG_VERSION, game->log);
+    for (i = 0; i < 8; i++) putc((int)(game->board_seed >> (8 * i)) & 0xff, game->log);
+    log_varint(game->log, game->board_size);
+    log_varint(game->log, game->total_mines);
+    fflush(game->log);
+}
+
+/* Flushed straight away, so the log holds every move up to a crash. */
+void log_event(Game *game, int kind, unsigned long long value) {
+    if (!game->log) return;
+    log_varint(game->log, value << 2 | kind);
+    fflush(game->log);
+}
+
+void close_log(Game *game) {
+    if (!game->log) return;
+    log_event(game, LOG_END, !game->game_over ? LOG_QUIT : board_cleared(game) ? LOG_WON : LOG_LOST);
+    fclose(game->log);
+    game->log = NULL;
+}
+
+/* Opens a cell and records what it revealed as one undo group. The game is over once a mine is hit or the
+   board is clear. Nothing is printed, so replays use this too. Returns 1 for a mine, and -1 if the move
+   could not be recorded for lack of memory, in which case the board is left as it was. */
+int open_cell(Game *game, int row, int col) {
+    int recorded, i;
+    if (is_mine(game, row, col)) {
+        long long cell = (long long)row * game->board_size + col;
+        if (!record_group(game, &cell, 1)) return -1;
+        set_revealed(game, row, col, 1);
+        game->game_over = 1;
+        return 1;
+    }
+    Span opened = flood_fill(game, row, col);
+    if (game->fill_region >= 0 && opened.count == game->regions[game->fill_region].count) {
+        recorded = record_region(game, game->fill_region);
+    } else {
+        recorded = record_group(game, &game->fill_cells[opened.start], opened.count);
+    }
+    if (!recorded) {
+        for (i = 0; i < opened.count; i++) {
+            long long cell = game->fill_cells[opened.start + i];
+            set_revealed(game, (int)(cell / game->board_size), (int)(cell % game->board_size), 0);
+        }
+        return -1;
+    }
+    if (board_cleared(game)) game->game_over = 1;
+    return 0;
+}
+
+void play_move(Game *game, int row, int col) {
+    if (row < game->view_row || row >= game->view_row + game->view_height || col < game->view_col || col >= game->view_col + game->view_width) {
+        centre_view(game, row, col);
+    }
+    int result = open_cell(game, row, col);
+    if (result >= 0) log_event(game, LOG_REVEAL, (unsigned long long)row * game->board_size + col);
+    if (result < 0) {
+        printf("\nNot enough memory to make that move.\n");
+    } else if (result) {
+        gameOver(game);
+    } else if (game->game_over) {
+        printf("\nBoard cleared. You win!\n");
+        print_board(game, 0);
+    }
+}
+
+void give_hint(Game *game) {
+    Solution solution;
+    if (!solve_board(game, &solution)) {
+        printf("Not enough memory to solve the board.\n");
+        free(solution.safe_cells);
+        return;
+    }
+    if (solution.safe_count > 0) {
+        printf("Row %lld, Col %lld is safe", solution.safe_cells[0] / game->board_size, solution.safe_cells[0] % game->board_size);
+        if (solution.safe_count > 1) printf(" (%d safe cells known)", solution.safe_count);
+        printf(".\n");
+    } else {
+        printf("Nothing is certain. Best guess: Row %d, Col %d with a %.1f%% chance of a mine.\n",
+               solution.guess_row, solution.guess_col, solution.guess_probability * 100);
+    }
+    if (solution.mine_count > 0) printf("%d mine%s located.\n", solution.mine_count, solution.mine_count > 1 ? "s" : "");
+    free(solution.safe_cells);
+}
+
+/* Opens every cell the solver proves safe, guesses the likeliest safe cell when stuck, and stops when the
+   game ends or after AUTO_MOVE_LIMIT moves. */
+void auto_play(Game *game) {
+    int moves = 0;
+    int i;
+    while (!game->game_over && moves < AUTO_MOVE_LIMIT) {
+        Solution solution;
+        if (!solve_board(game, &solution)) {
+            printf("Not enough memory to solve the board.\n");
+            free(solution.safe_cells);
+            break;
+        }
+        if (solution.safe_count > 0) {
+            for (i = 0; i < solution.safe_count && !game->game_over; i++) {
+                int row = (int)(solution.safe_cells[i] / game->board_size);
+                int col = (int)(solution.safe_cells[i] % game->board_size);
+                if (is_revealed(game, row, col)) continue;
+                play_move(game, row, col);
+                moves++;
+            }
+        } else {
+            printf("Guessing Row %d, Col %d (%.1f%% chance of a mine).\n", solution.guess_row, solution.guess_col, solution.guess_probability * 100);
+            play_move(game, solution.guess_row, solution.guess_col);
+            moves++;
+        }
+        free(solution.safe_cells);
+    }
+    if (!game->game_over) printf("Auto-play paused after %d moves.\n", moves);
+}
+
+/* Plays one board with the solver, opening every certain cell and guessing the safest one when stuck.
+   Nothing is printed and nothing is kept for undo. A solver out of memory counts as a loss, and a board
+   there is no memory for returns -1. */
+int simulate_game(Game *game, int size, long long mines, uint64_t seed, int *guesses) {
+    int i;
+    *guesses = 0;
+    if (!setup_board(game, size, mines, seed)) return -1;
+    while (1) {
+        Solution solution;
+        int lost = 0;
+        if (!solve_board(game, &solution)) {
+            free(solution.safe_cells);
+            return 0;
+        }
+        if (solution.safe_count > 0) {
+            for (i = 0; i < solution.safe_count; i++) {
+                int row = (int)(solution.safe_cells[i] / game->board_size);
+                int col = (int)(solution.safe_cells[i] % game->board_size);
+                flood_fill(game, row, col);
+            }
+        } else {
+            (*guesses)++;
+            if (is_mine(game, solution.guess_row, solution.guess_col)) {
+                lost = 1;
+            } else {
+                flood_fill(game, solution.guess_row, solution.guess_col);
+            }
+        }
+        free(solution.safe_cells);
+        if (lost) return 0;
+        if (board_cleared(game)) return 1;
+    }
+}
+
+/* Seed of the index-th board of a run, so a run is reproducible from its base seed. */
+uint64_t candidate_seed(uint64_t base_seed, long long index) {
+    uint64_t state = base_seed ^ ((uint64_t)index * 0x9E3779B97F4A7C15ULL);
+    return splitmix64(&state);
 }
 
-int main() {
+typedef struct {
+    GamePool *pool;
+    int size;
+    long long mines;
+    long long games;
+    int workers;
+    int worker;
+    uint64_t base_seed;
+    int threaded;              /* started on its own thread, so it has to be joined */
+    SimulationTotals totals;
+} SimulationWorker;
+
+void *simulation_worker(void *arg) {
+    SimulationWorker *worker = arg;
+    Game *game = acquire_game(worker->pool);
+    long long index;
+
+    /* Games that cannot be played are left out of the totals, which count only what was played. */
+    if (!game) return NULL;
+    game->solver_threads = 1;
+    for (index = worker->worker; index < worker->games; index += worker->workers) {
+        int guesses;
+        int won = simulate_game(game, worker->size, worker->mines, candidate_seed(worker->base_seed, index), &guesses);
+        if (won < 0) continue;
+        int bucket = guesses < GUESS_BUCKETS - 1 ? guesses : GUESS_BUCKETS - 1;
+        worker->totals.games++;
+        worker->totals.wins += won;
+        worker->totals.guesses += guesses;
+        worker->totals.games_by_guesses[bucket]++;
+        worker->totals.wins_by_guesses[bucket] += won;
+    }
+    release_game(worker->pool, game);
+    return NULL;
+}
+
+/* Every worker thread takes a game from the pool and plays every workers-th board on it. A worker whose
+   thread cannot be started plays its share on this thread. */
+void run_simulation(GamePool *pool, int size, long long mines, long long games, int workers, uint64_t base_seed) {
+    SimulationWorker *jobs = calloc(workers, sizeof(SimulationWorker));
+    pthread_t *threads = malloc(workers * sizeof(pthread_t));
+    SimulationTotals totals;
+    struct timespec start, end;
+    int w, i;
+
+    if (!jobs || !threads) {
+        printf("Not enough memory to simulate %lld games.\n", games);
+        free(jobs);
+        free(threads);
+        return;
+    }
+    memset(&totals, 0, sizeof(totals));
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (w = 0; w < workers; w++) {
+        jobs[w].pool = pool;
+        jobs[w].size = size;
+        jobs[w].mines = mines;
+        jobs[w].games = games;
+        jobs[w].workers = workers;
+        jobs[w].worker = w;
+        jobs[w].base_seed = base_seed;
+        jobs[w].threaded = pthread_create(&threads[w], NULL, simulation_worker, &jobs[w]) == 0;
+        if (!jobs[w].threaded) simulation_worker(&jobs[w]);
+    }
+    for (w = 0; w < workers; w++) {
+        SimulationTotals *part = &jobs[w].totals;
+        if (jobs[w].threaded) pthread_join(threads[w], NULL);
+        totals.games += part->games;
+        totals.wins += part->wins;
+        totals.guesses += part->guesses;
+        for (i = 0; i < GUESS_BUCKETS; i++) {
+            totals.games_by_guesses[i] += part->games_by_guesses[i];
+            totals.wins_by_guesses[i] += part->wins_by_guesses[i];
+        }
+    }
+    free(jobs);
+    free(threads);
+    clock_gettime(CLOCK_MONOTONIC, &end);
+
+    double seconds = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+    long long largest = 1;
+    for (i = 0; i < GUESS_BUCKETS; i++) {
+        if (totals.games_by_guesses[i] > largest) largest = totals.games_by_guesses[i];
+    }
+    if (totals.games < games) printf("%lld games could not be played for lack of memory and were left out.\n", games - totals.games);
+    printf("Size %d, %lld mines (density %.3f): %lld games, %.2f%% won, %.3f guesses per game, %.0f games/s\n", size, mines,
+           (double)mines / ((double)size * size), totals.games,
+           totals.games ? 100.0 * totals.wins / totals.games : 0, totals.games ? (double)totals.guesses / totals.games : 0,
+           seconds > 0 ? totals.games / seconds : 0);
+    for (i = 0; i < GUESS_BUCKETS; i++) {
+        long long count = totals.games_by_guesses[i];
+        int bar = (int)(HISTOGRAM_WIDTH * count / largest);
+        printf("  %2d%s guesses %10lld games %7.2f%% won |", i, i == GUESS_BUCKETS - 1 ? "+" : " ", count,
+               count ? 100.0 * totals.wins_by_guesses[i] / count : 0);
+        while (bar-- > 0) printf("#");
+        printf("\n");
+    }
+}
+
+/* Opens the start cell and after that only cells the solver proves safe. Returns 1 if that clears the board,
+   so the board can be won from the start cell without a single guess. */
+int clears_without_guessing(Game *game, int row, int col) {
+    int i;
+    if (is_mine(game, row, col)) return 0;
+    flood_fill(game, row, col);
+    while (!board_cleared(game)) {
+        Solution solution;
+        solve_board(game, &solution); /* out of memory finds nothing safe, so the board is not proven */
+        for (i = 0; i < solution.safe_count; i++) {
+            flood_fill(game, (int)(solution.safe_cells[i] / game->board_size), (int)(solution.safe_cells[i] % game->board_size));
+        }
+        free(solution.safe_cells);
+        if (!solution.safe_count) return 0;
+    }
+    return 1;
+}
+
+typedef struct {
+    GamePool *pool;
+    int size;
+    long long mines;
+    uint64_t base_seed;
+    atomic_llong next_candidate;
+    atomic_llong found;
+    atomic_int searching;      /* workers that got a game to test on */
+} NoGuessSearch;
+
+/* Workers claim candidate boards in order and test them, until a candidate at or past the lowest success so
+   far comes up. Every candidate below the winner is tested by someone, so the search returns the same board
+   for the same base seed however many workers run it. */
+void *no_guess_worker(void *arg) {
+    NoGuessSearch *search = arg;
+    Game *game = acquire_game(search->pool);
+
+    if (!game) return NULL;
+    atomic_fetch_add(&search->searching, 1);
+    game->solver_threads = 1;
+    while (1) {
+        long long index = atomic_fetch_add(&search->next_candidate, 1);
+        if (index >= atomic_load(&search->found) || index >= NO_GUESS_CANDIDATE_LIMIT) break;
+        if (!setup_board(game, search->size, search->mines, candidate_seed(search->base_seed, index))) continue;
+        if (!clears_without_guessing(game, search->size / 2, search->size / 2)) continue;
+        long long best = atomic_load(&search->found);
+        while (index < best && !atomic_compare_exchange_weak(&search->found, &best, index)) {
+        }
+    }
+    release_game(search->pool, game);
+    return NULL;
+}
+
+/* Returns the index of the first candidate board that can be cleared from the centre cell without guessing,
+   -1 if none of the first NO_GUESS_CANDIDATE_LIMIT can, or -2 if there was no memory to search at all.
+   If not every thread can be started, this thread searches too, so the answer is the same. */
+long long find_no_guess_board(GamePool *pool, int size, long long mines, int workers, uint64_t base_seed) {
+    NoGuessSearch search;
+    pthread_t *threads = malloc(workers * sizeof(pthread_t));
+    int started = 0;
+    int w;
+
+    if (!threads) return -2;
+    search.pool = pool;
+    search.size = size;
+    search.mines = mines;
+    search.base_seed = base_seed;
+    atomic_init(&search.next_candidate, 0);
+    atomic_init(&search.found, NO_GUESS_CANDIDATE_LIMIT);
+    atomic_init(&search.searching, 0);
+    while (started < workers && pthread_create(&threads[started], NULL, no_guess_worker, &search) == 0) started++;
+    if (started < workers) no_guess_worker(&search);
+    for (w = 0; w < started; w++) pthread_join(threads[w], NULL);
+    free(threads);
+    if (!atomic_load(&search.searching)) return -2;
+    return atomic_load(&search.found) < NO_GUESS_CANDIDATE_LIMIT ? atomic_load(&search.found) : -1;
+}
+
+/* Generates no-guess boards one after another and reports how long a player would wait for one. */
+void run_generator(GamePool *pool, int size, long long mines, long long boards, int workers, uint64_t base_seed) {
+    long long found = 0, candidates = 0, b;
+    double total = 0, slowest = 0;
+
+    for (b = 0; b < boards; b++) {
+        struct timespec start, end;
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        long long index = find_no_guess_board(pool, size, mines, workers, candidate_seed(base_seed, b));
+        clock_gettime(CLOCK_MONOTONIC, &end);
+        double seconds = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+        total += seconds;
+        if (seconds > slowest) slowest = seconds;
+        if (index == -2) {
+            printf("Not enough memory to search for boards.\n");
+            return;
+        }
+        if (index < 0) {
+            candidates += NO_GUESS_CANDIDATE_LIMIT;
+            continue;
+        }
+        found++;
+        candidates += index + 1;
+    }
+    printf("Size %d, %lld mines (density %.3f): %lld of %lld boards found, %.1f candidates per board, %.2f ms average, %.2f ms slowest\n",
+           size, mines, (double)mines / ((double)size * size), found, boards, boards ? (double)candidates / boards : 0,
+           boards ? 1000 * total / boards : 0, 1000 * slowest);
+}
+
+/* 3BV, the fewest clicks that clear the board: one for each opening, plus one for each number that no
+   opening reveals. -1 if the regions could not be labelled. */
+long long min_clicks(Game *game) {
+    int cells = game->board_size * game->board_size;
+    long long clicks;
+    int i;
+
+    if (!game->regions_labelled && !label_regions(game)) return -1;
+    clicks = game->region_count;
+    for (i = 0; i < cells; i++) {
+        int found[4];
+        int r = i / game->board_size;
+        int c = i % game->board_size;
+        if (game->region_of[i] < 0 && !is_mine(game, r, c) && !bordering_regions(game, r, c, found)) clicks++;
+    }
+    return clicks;
+}
+
+typedef struct {
+    uint64_t seed;
+    long long clicks;
+    int openings;
+    int guesses;
+    int won;
+} Grade;
+
+typedef struct {
+    GamePool *pool;
+    int size;
+    long long mines;
+    long long first;   /* index of grades[0] in the whole batch */
+    long long boards;  /* boards in this block */
+    int workers;
+    int worker;
+    uint64_t base_seed;
+    int threaded;      /* started on its own thread, so it has to be joined */
+    Grade *grades;
+} GradeWorker;
+
+void *grade_worker(void *arg) {
+    GradeWorker *worker = arg;
+    Game *game = acquire_game(worker->pool);
+    long long index;
+
+    /* A board that cannot be graded keeps clicks at -1 and is left out. */
+    for (index = worker->worker; index < worker->boards; index += worker->workers) worker->grades[index].clicks = -1;
+    if (!game) return NULL;
+    game->solver_threads = 1;
+    for (index = worker->worker; index < worker->boards; index += worker->workers) {
+        Grade *grade = &worker->grades[index];
+        grade->seed = candidate_seed(worker->base_seed, worker->first + index);
+        if (!setup_board(game, worker->size, worker->mines, grade->seed)) continue;
+        grade->clicks = min_clicks(game);
+        if (grade->clicks < 0) continue;
+        grade->openings = game->region_count;
+        grade->won = simulate_game(game, worker->size, worker->mines, grade->seed, &grade->guesses);
+        if (grade->won < 0) grade->clicks = -1;
+    }
+    release_game(worker->pool, game);
+    return NULL;
+}
+
+/* Grades a batch of boards on worker threads, each taking every workers-th board, and appends one line per
+   board to grades.csv so a day's boards can be filtered by difficulty. The boards are graded GRADE_BLOCK at
+   a time, so a batch of any size needs the same memory. A worker whose thread cannot be started grades its
+   share on this thread. */
+void run_grading(GamePool *pool, int size, long long mines, long long boards, int workers, uint64_t base_seed) {
+    long long block = boards < GRADE_BLOCK ? boards : GRADE_BLOCK;
+    GradeWorker *jobs = calloc(workers, sizeof(GradeWorker));
+    pthread_t *threads = malloc(workers * sizeof(pthread_t));
+    Grade *grades = malloc(block * sizeof(Grade));
+    struct timespec start, end;
+    long long clicks = 0, openings = 0, guesses = 0, wins = 0, fewest = LLONG_MAX, most = 0, graded = 0, first, b;
+    int w;
+
+    if (!jobs || !threads || !grades) {
+        printf("Not enough memory to grade %lld boards.\n", boards);
+        free(jobs);
+        free(threads);
+        free(grades);
+        return;
+    }
+    FILE *fp = fopen("grades.csv", "a");
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (first = 0; first < boards; first += block) {
+        long long count = boards - first < block ? boards - first : block;
+        for (w = 0; w < workers; w++) {
+            jobs[w].pool = pool;
+            jobs[w].size = size;
+            jobs[w].mines = mines;
+            jobs[w].first = first;
+            jobs[w].boards = count;
+            jobs[w].workers = workers;
+            jobs[w].worker = w;
+            jobs[w].base_seed = base_seed;
+            jobs[w].grades = grades;
+            jobs[w].threaded = pthread_create(&threads[w], NULL, grade_worker, &jobs[w]) == 0;
+            if (!jobs[w].threaded) grade_worker(&jobs[w]);
+        }
+        for (w = 0; w < workers; w++) {
+            if (jobs[w].threaded) pthread_join(threads[w], NULL);
+        }
+
+        for (b = 0; b < count; b++) {
+            Grade *grade = &grades[b];
+            if (grade->clicks < 0) continue;
+            graded++;
+            if (fp) fprintf(fp, "%llu,%d,%lld,%lld,%d,%d,%d\n", (unsigned long long)grade->seed, size, mines, grade->clicks, grade->openings, grade->guesses, grade->won);
+            clicks += grade->clicks;
+            openings += grade->openings;
+            guesses += grade->guesses;
+            wins += grade->won;
+            if (grade->clicks < fewest) fewest = grade->clicks;
+            if (grade->clicks > most) most = grade->clicks;
+        }
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    if (fp) fclose(fp);
+    free(jobs);
+    free(threads);
+    free(grades);
+
+    double seconds = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+    if (graded < boards) printf("%lld boards could not be graded for lack of memory and were left out.\n", boards - graded);
+    if (!graded) return;
+    printf("Size %d, %lld mines (density %.3f): %lld boards, 3BV %.1f (%lld-%lld), %.2f openings, %.3f guesses, %.2f%% won by the solver, %.0f boards/s\n",
+           size, mines, (double)mines / ((double)size * size), graded, (double)clicks / graded, fewest, most, (double)openings / graded,
+           (double)guesses / graded, 100.0 * wins / graded, seconds > 0 ? boards / seconds : 0);
+}
+
+/* A log file read back into memory. */
+typedef struct {
+    unsigned char *data;
+    long long length;
+    long long offset;
+} LogReader;
+
+int read_log_varint(LogReader *reader, unsigned long long *value) {
+    int shift = 0;
+    *value = 0;
+    while (reader->offset < reader->length && shift < 64) {
+        unsigned char byte = reader->data[reader->offset++];
+        if (shift == 63 && byte > 1) return 0; /* more than 64 bits */
+        *value |= (unsigned long long)(byte & 0x7f) << shift;
+        if (!(byte & 0x80)) return 1;
+        shift += 7;
+    }
+    return 0;
+}
+
+/* True if a game header starts at the reader's offset. No event is ever written with the bytes of
+   LOG_MAGIC at its start ('M' would be an undo of cell 19), so this finds where a game cut short ends. */
+int at_log_game(const LogReader *reader) {
+    return reader->length - reader->offset >= 4 && memcmp(reader->data + reader->offset, LOG_MAGIC, 4) == 0;
+}
+
+/* Moves the reader past a damaged stretch of the log to the next game header, or to the end. */
+void skip_to_log_game(LogReader *reader) {
+    while (reader->offset < reader->length && !at_log_game(reader)) reader->offset++;
+}
+
+/* Reads the header of the next game and leaves the reader at its first event. A bad header leaves the
+   reader where it was. */
+int read_log_game(LogReader *reader, int *size, long long *mines, uint64_t *seed) {
+    unsigned long long value;
+    long long start = reader->offset;
+    int i;
+
+    if (reader->length - reader->offset < 15 || !at_log_game(reader)) return 0;
+    if (reader->data[reader->offset + 4] != LOG_VERSION) return 0;
+    reader->offset += 5;
+    *seed = 0;
+    for (i = 0; i < 8; i++) *seed |= (uint64_t)reader->data[reader->offset++] << (8 * i);
+    if (!read_log_varint(reader, &value) || value < CLASSIC_MIN_SIZE || value > MAX_BOARD_SIZE) {
+        reader->offset = start;
+        return 0;
+    }
+    *size = (int)value;
+    if (!read_log_varint(reader, &value) || value >= (unsigned long long)*size * *size) {
+        reader->offset = start;
+        return 0;
+    }
+    *mines = (long long)value;
+    return 1;
+}
+
+/* Plays up to move_limit of a game's events on its board, or all of them when move_limit is negative, and
+   returns how many it played. Undo and redo step through the history as they did in play, so every
+   position of the game can be rebuilt. outcome is set once the game's end has been read, and stays -1 for a
+   game that stops without one. A damaged event ends the game too, with the reader moved on to the next one. */
+long long replay_events(Game *game, LogReader *reader, long long move_limit, int *outcome) {
+    unsigned long long event;
+    unsigned long long cells = (unsigned long long)game->board_size * game->board_size;
+    long long moves = 0;
+
+    *outcome = -1;
+    while (moves != move_limit && !at_log_game(reader) && reader->offset < reader->length) {
+        unsigned long long value;
+        if (!read_log_varint(reader, &event)) {
+            skip_to_log_game(reader);
+            return moves;
+        }
+        value = event >> 2;
+        switch (event & 3) {
+        case LOG_REVEAL:
+            if (value >= cells) {
+                skip_to_log_game(reader);
+                return moves;
+            }
+            if (!is_revealed(game, (int)(value / game->board_size), (int)(value % game->board_size))) {
+                open_cell(game, (int)(value / game->board_size), (int)(value % game->board_size));
+            }
+            break;
+        case LOG_UNDO:
+            if (game->group_top > 0) apply_group(game, --game->group_top, 0);
+            break;
+        case LOG_REDO:
+            if (game->group_top < game->group_count) apply_group(game, game->group_top++, 1);
+            break;
+        default:
+            if (value > LOG_LOST) {
+                skip_to_log_game(reader);
+                return moves;
+            }
+            *outcome = (int)value;
+            return moves;
+        }
+        moves++;
+    }
+    return moves;
+}
+
+/* Lists every game in a log, or shows one game after its first move_limit moves. */
+int run_replay(GamePool *pool, const char *path, int game_number, long long move_limit) {
+    static const char *outcomes[] = { "unfinished", "quit", "won", "lost" };
+    FILE *fp = fopen(path, "rb");
+    LogReader reader;
+    int size, number = 0, outcome;
+    long long mines, total_moves = 0;
+    uint64_t seed;
+
+    if (!fp) {
+        printf("Could not open %s.\n", path);
+        return 1;
+    }
+    /* The whole log is read at once, so it has to be a file whose size can be found. */
+    reader.length = fseek(fp, 0, SEEK_END) == 0 ? ftell(fp) : -1;
+    reader.offset = 0;
+    reader.data = reader.length >= 0 ? malloc(reader.length > 0 ? reader.length : 1) : NULL;
+    if (!reader.data || fseek(fp, 0, SEEK_SET) != 0) {
+        printf("Could not read %s.\n", path);
+        free(reader.data);
+        fclose(fp);
+        return 1;
+    }
+    reader.length = (long long)fread(reader.data, 1, reader.length, fp);
+    fclose(fp);
+
+    Game *game = acquire_game(pool);
+    if (!game) {
+        printf("Not enough memory to replay %s.\n", path);
+        free(reader.data);
+        return 1;
+    }
+    while (reader.offset < reader.length) {
+        struct timespec start, end;
+        long long moves;
+        if (!read_log_game(&reader, &size, &mines, &seed)) {
+            reader.offset++;
+            skip_to_log_game(&reader);
+            continue;
+        }
+        number++;
+        if (!setup_board(game, size, mines, seed)) {
+            printf("Game %d: size %d, %lld mines, seed %llu, not enough memory to replay it\n", number, size, mines, (unsigned long long)seed);
+            skip_to_log_game(&reader);
+            if (number == game_number) break;
+            continue;
+        }
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        moves = replay_events(game, &reader, number == game_number ? move_limit : -1, &outcome);
+        clock_gettime(CLOCK_MONOTONIC, &end);
+        total_moves += moves;
+        if (!game_number) {
+            printf("Game %d: size %d, %lld mines, seed %llu, %lld moves, %s\n", number, size, mines, (unsigned long long)seed, moves,
+                   outcomes[outcome + 1]);
+        } else if (number == game_number) {
+            print_board(game, 0);
+            printf("\nGame %d after %lld moves: %lld cells revealed, rebuilt in %.3f ms.\n", number, moves, game->revealed_count,
+                   ((end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9) * 1000);
+            break;
+        }
+    }
+    if (!game_number) {
+        printf("%d games, %lld moves in %lld bytes.\n", number, total_moves, reader.length);
+    } else if (number != game_number) {
+        printf("There is no game %d in %s.\n", game_number, path);
+    }
+    release_game(pool, game);
+    free(reader.data);
+    return !game_number || number == game_number ? 0 : 1;
+}
+
+int parse_list(char *text, double values[MAX_SWEEP_VALUES]) {
+    int count = 0;
+    char *item = strtok(text, ",");
+    while (item && count < MAX_SWEEP_VALUES) {
+        values[count++] = atof(item);
+        item = strtok(NULL, ",");
+    }
+    return count;
+}
+
+int main(int argc, char *argv[]) {
     char input[20];
     int row, col;
+    double sizes[MAX_SWEEP_VALUES];
+    double densities[MAX_SWEEP_VALUES];
+    int size_count = 0;
+    int density_count = 0;
+    long long games = 0;
+    long long boards = 0;
+    long long graded = 0;
+    int no_guess = 0;
+    const char *log_path = DEFAULT_LOG;
+    const char *replay_path = NULL;
+    int game_number = 0;
+    long long move_limit = -1;
+    long long mines = 0;
+    uint64_t seed = (uint64_t)time(NULL);
+    int workers = (int)sysconf(_SC_NPROCESSORS_ONLN);
+    GamePool pool;
+    int i, j;
+
+    for (i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "-d") == 0 && i + 1 < argc) {
+            density_count = parse_list(argv[++i], densities);
+        } else if (strcmp(argv[i], "-S") == 0 && i + 1 < argc) {
+            games = atoll(argv[++i]);
+        } else if (strcmp(argv[i], "-G") == 0 && i + 1 < argc) {
+            boards = atoll(argv[++i]);
+        } else if (strcmp(argv[i], "-D") == 0 && i + 1 < argc) {
+            graded = atoll(argv[++i]);
+        } else if (strcmp(argv[i], "-l") == 0 && i + 1 < argc) {
+            log_path = argv[++i];
+        } else if (strcmp(argv[i], "-R") == 0 && i + 1 < argc) {
+            replay_path = argv[++i];
+        } else if (strcmp(argv[i], "-g") == 0 && i + 1 < argc) {
+            game_number = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "-t") == 0 && i + 1 < argc) {
+            move_limit = atoll(argv[++i]);
+        } else if (strcmp(argv[i], "-n") == 0) {
+            no_guess = 1;
+        } else if (strcmp(argv[i], "-m") == 0 && i + 1 < argc) {
+            mines = atoll(argv[++i]);
+        } else if (strcmp(argv[i], "-r") == 0 && i + 1 < argc) {
+            seed = strtoull(argv[++i], NULL, 10);
+        } else if (strcmp(argv[i], "-j") == 0 && i + 1 < argc) {
+            workers = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "-s") == 0 && i + 1 < argc) {
+            size_count = parse_list(argv[++i], sizes);
+        } else if (argv[i][0] != '-') {
+            size_count = parse_list(argv[i], sizes);
+        } else {
+            printf("Usage: %s [size] [-s sizes] [-d densities] [-m mines] [-r seed] [-S games] [-G boards] [-D boards] [-n] [-l log] [-j workers]\n"
+                   "       %s -R log [-g game] [-t moves]\n", argv[0], argv[0]);
+            return 1;
+        }
+    }
+    if (!size_count && (games > 0 || boards > 0 || graded > 0 || no_guess)) sizes[size_count++] = 9;
+    for (i = 0; i < size_count; i++) {
+        if (sizes[i] < CLASSIC_MIN_SIZE || sizes[i] > MAX_BOARD_SIZE) {
+            printf("Board size must be between %d and %d.\n", CLASSIC_MIN_SIZE, MAX_BOARD_SIZE);
+            return 1;
+        }
+        if (mines >= sizes[i] * sizes[i]) {
+            printf("A %dx%d board has room for at most %lld mines.\n", (int)sizes[i], (int)sizes[i], (long long)(sizes[i] * sizes[i]) - 1);
+            return 1;
+        }
+    }
+    if (mines < 0 || (!size_count && mines >= CLASSIC_MIN_SIZE * CLASSIC_MIN_SIZE)) {
+        printf("Give a board size with -m, or at most %d mines.\n", CLASSIC_MIN_SIZE * CLASSIC_MIN_SIZE - 1);
+        return 1;
+    }
+    for (i = 0; graded > 0 && i < size_count; i++) {
+        if (sizes[i] > REGION_LABEL_SIZE) {
+            printf("Boards up to %d a side can be graded.\n", REGION_LABEL_SIZE);
+            return 1;
+        }
+    }
+    for (i = 0; i < density_count; i++) {
+        if (densities[i] <= 0 || densities[i] >= 1) {
+            printf("Mine density must be between 0 and 1.\n");
+            return 1;
+        }
+    }
+    if (workers < 1) workers = 1;
+    init_pool(&pool);
+
+    if (replay_path) {
+        int status = run_replay(&pool, replay_path, game_number, move_limit);
+        free_pool(&pool);
+        return status;
+    }
+
+    if (games > 0 || boards > 0 || graded > 0) {
+        if (!density_count) densities[density_count++] = DEFAULT_DENSITY;
+        if (mines > 0) density_count = 1;
+        printf("%s with %d workers, seed %llu.\n", games > 0 ? "Simulating" : graded > 0 ? "Grading" : "Generating no-guess boards", workers,
+               (unsigned long long)seed);
+        for (i = 0; i < size_count; i++) {
+            for (j = 0; j < density_count; j++) {
+                long long count = mines > 0 ? mines : board_mines((int)sizes[i], densities[j]);
+                if (games > 0) {
+                    run_simulation(&pool, (int)sizes[i], count, games, workers, seed);
+                } else if (graded > 0) {
+                    run_grading(&pool, (int)sizes[i], count, graded, workers, seed);
+                } else {
+                    run_generator(&pool, (int)sizes[i], count, boards, workers, seed);
+                }
+            }
+        }
+        free_pool(&pool);
+        return 0;
+    }
 
-    generate_board();
+    Game *game = acquire_game(&pool);
+    if (!game) {
+        printf("Not enough memory to start a game.\n");
+        free_pool(&pool);
+        return 1;
+    }
+    game->terminal = isatty(STDOUT_FILENO);
+    if (no_guess) {
+        int size = (int)sizes[0];
+        long long count = mines > 0 ? mines : board_mines(size, density_count ? densities[0] : DEFAULT_DENSITY);
+        long long index = find_no_guess_board(&pool, size, count, workers, seed);
+        if (index < 0 || !generate_board(game, size, 0, count, candidate_seed(seed, index))) {
+            if (index == -1) printf("No board in the first %d candidates can be cleared without guessing.\n", NO_GUESS_CANDIDATE_LIMIT);
+            else printf("Not enough memory for a board of size %d.\n", size);
+            release_game(&pool, game);
+            free_pool(&pool);
+            return 1;
+        }
+        open_log(game, log_path);
+        play_move(game, size / 2, size / 2);
+        print_board(game, 0);
+        printf("This board can be cleared without guessing. Started at Row %d, Col %d.\n", size / 2, size / 2);
+    } else {
+        if (!generate_board(game, size_count ? (int)sizes[0] : 0, density_count ? densities[0] : 0, mines, seed)) {
+            printf("Not enough memory for the board.\n");
+            release_game(&pool, game);
+            free_pool(&pool);
+            return 1;
+        }
+        open_log(game, log_path);
+    }
 
-    while (!game_over) {
-        print_board(0);
-        printf("\nEnter move (row col) or 'undo': ");
-        scanf("%s", input);
+    while (!game->game_over) {
+        print_board(game, 0);
+        printf("\nEnter move (row col), 'undo', 'redo', 'hint' or 'auto': ");
+        if (scanf("%19s", input) != 1) break;
 
-        if (strcmp(input, "undo") == 0) {
-            pop_group();
+        if (strcmp(input, "w") == 0 || strcmp(input, "a") == 0 || strcmp(input, "s") == 0 || strcmp(input, "d") == 0) {
+            scroll_view(game, (input[0] == 's') - (input[0] == 'w'), (input[0] == 'd') - (input[0] == 'a'));
+        } else if (strcmp(input, "undo") == 0) {
+            if (pop_group(game)) log_event(game, LOG_UNDO, 0);
+        } else if (strcmp(input, "redo") == 0) {
+            if (redo_group(game)) log_event(game, LOG_REDO, 0);
+        } else if (strcmp(input, "hint") == 0) {
+            give_hint(game);
+        } else if (strcmp(input, "auto") == 0) {
+            auto_play(game);
         } else {
             row = atoi(input);
             scanf("%d", &col);
 
-            if (row < 0 || row >= board_size || col < 0 || col >= board_size) {
+            if (row < 0 || row >= game->board_size || col < 0 || col >= game->board_size) {
                 printf("Invalid move. Try again.\n");
                 continue;
             }
-            if (revealed[row][col]) {
+            if (is_revealed(game, row, col)) {
                 printf("Already revealed. Try again.\n");
                 continue;
             }
 
-            if (mine_board[row][col]) {
-                push(row, col); 
-                push_count[move_history_top++] = 1;
-                gameOver(row, col);
-            } else {
-                int opened = flood_fill(row, col);
-                push_count[move_history_top++] = opened;
-            }
+            play_move(game, row, col);
         }
     }
 
-    save_moves();
+    close_screen(game);
+    close_log(game);
+    save_moves(game);
+    release_game(&pool, game);
+    free_pool(&pool);
     return 0;
 }
@@ -3,12 +3,79 @@
 #include <string.h>
 #include <ctype.h>
 #include <stdbool.h>
+#include <stdatomic.h>
+#include <pthread.h>
+#include <time.h>
+#include <math.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#define MAX_SIZE 20
+#define MAX_CELLS (MAX_SIZE * MAX_SIZE)
+#define BOARD_STRIDE (MAX_SIZE + 2)  /* Cells per row of the flat board, the border on both sides included. */
+#define BOARD_BYTES 496              /* (MAX_SIZE + 2) rows of BOARD_STRIDE cells, rounded up to whole vectors. */
+#define VECTOR_BYTES 16
+#define BOARD_WORDS 8                /* 64 bit words of a CellSet, one bit per byte of the flat board. */
+#define CELL(row, col) (((row) + 1) * BOARD_STRIDE + (col) + 1) /* Index of a board cell in the flat board. */
+#define ENDGAME_DEFAULT_EMPTIES 14 /* The computer plays perfectly once this few cells are left. */
+#define ENDGAME_MAX_EMPTIES 30     /* Anything deeper than this would never finish. */
+#define FASTEST_FIRST_EMPTIES 7    /* Below this many empties move ordering costs more than it saves. */
+#define DEFAULT_DEPTH 4            /* How many moves ahead the computer looks in the midgame. */
+#define MAX_DEPTH 20
+#define MAX_PLY 32                 /* Longest line any search plays out, endgame or midgame. */
+#define MAX_THREADS 64
+#define SPLIT_DEPTH 3              /* Midgame nodes with this many plies left to search may share their moves between threads. */
+#define SPLIT_EMPTIES 10           /* The same for endgame nodes with this many empties. */
+#define JOURNAL_CAPACITY (2 * MAX_CELLS) /* Every move of a game and a pass before each of them. */
+#define UNDO_MOVE -2               /* Row of the position getUserMove returns when the user asks for an undo. */
+#define TABLE_BITS 20              /* The transposition table has 2^20 entries (16 MB). */
+#define WIN_SCORE 10000            /* A won game is worth more than any evaluation. */
+#define MOBILITY_WEIGHT 4
+#define STABILITY_WEIGHT 12        /* A disc that can never be lost is worth more than any cell value but a corner's. */
+#define STABILITY_EMPTIES 6        /* The endgame solver looks for stability cutoffs with at least this many empties. */
+#define SCORE_INFINITY 1000000
+#define PATTERN_TYPES 4            /* 3x3 corner, edge, second line and diagonal. */
+#define PATTERN_PHASES 6           /* Separate weights for each sixth of the game. */
+#define MAX_PATTERNS 24            /* Instances of the types around the four corners. */
+#define MAX_PATTERN_LENGTH 9
+#define MAX_PATTERN_REFS 16        /* Most pattern instances one cell can be part of. */
+#define PATTERN_TABLE_SIZE 19683   /* 3^9, every filling of the longest pattern. */
+#define PATTERN_SCALE 10           /* Evaluation units per predicted disc. */
+#define TRAINING_EPOCHS 20
+#define OPENING_MOVES 8            /* Random moves that start each self-play game. */
+#define BOOK_MAGIC 0x314B4256      /* "VBK1" at the start of a book file. */
+#define DATABASE_MAGIC 0x31424456  /* "VDB1" at the start of a game database. */
+#define DATABASE_SHOWN_GAMES 5     /* Games a database query lists, besides counting all of them. */
+#define TOURNAMENT_TABLE_BITS 16   /* Every engine of every tournament thread gets its own 1 MB table. */
+#define TIME_BUCKETS 14            /* Move time histogram: under 0.1 ms, then each bucket twice as wide. */
+#define ANALYSIS_TABLE_BITS 18     /* Every analysis thread gets its own 4 MB table. */
+#define TREE_DEFAULT_MEMORY 64     /* Megabytes of tree nodes the MCTS engine may use per game. */
+#define TREE_TOURNAMENT_MEMORY 8   /* The same for each MCTS engine of each tournament thread. */
+#define TREE_REUSE_PLIES 2         /* The computer's own move and the reply, the tree is searched this deep for the new position. */
+#define UCT_EXPLORATION 1.0        /* Weight of the exploration term of UCT against the win rate. */
+#define VIRTUAL_LOSS 3             /* Lost playouts a node is charged while a thread is below it, so the other threads look elsewhere. */
+#define MAX_GAME_PLIES (2 * MAX_CELLS) /* Every move of a game and a pass before each of them. */
 
 typedef enum {
     EMPTY = 0,
     COMPUTER = 1,  /* X for computer */
-    USER = 2       /* O for user */
+    USER = 2,      /* O for user */
+    WALL = 3       /* The border around the board, so scans stop without checking bounds. */
 } CellState;
+/* The board as one block, a byte per cell, with a border of WALL cells all around.
+   The stride is the same for every size, everything right of and below a smaller board is WALL too. */
+typedef struct {
+    unsigned char cells[BOARD_BYTES];
+    int size;
+} Board;
+/* A set of cells as bits, bit i stands for cells[i] of the flat board, so a step through the board is a shift of the set. */
+typedef struct {
+    unsigned long long words[BOARD_WORDS];
+} CellSet;
+/* Bytes compared at once by countCells, the compiler turns these into SIMD instructions where the machine has them. */
+typedef unsigned char ByteVector __attribute__((vector_size(VECTOR_BYTES)));
 //Player
 typedef struct {
     int row;
@@ -19,51 +86,456 @@ typedef struct {
     Position pos;
     int score;
 } Move;
+/* A line of play from some position, a row of -1 is a pass. */
+typedef struct {
+    Position moves[MAX_PLY];
+    int length;
+} Line;
+/* A move as the journal remembers it, enough to take it back without a copy of the board. */
+typedef struct {
+    Position pos;           /* Row -1 for a pass. */
+    CellState player;
+    unsigned char rays[8];  /* How many discs were flipped in each of the 8 directions. */
+} JournalMove;
+/* The legal moves of both players in the current position, kept up to date move by move instead of rescanning the board. */
+typedef struct {
+    bool legal[3][MAX_SIZE][MAX_SIZE]; /* Indexed by CellState. */
+    int count[3];
+} MoveCache;
+/* The moves played so far, newest last. It never allocates, a full journal refuses further moves. */
+typedef struct {
+    JournalMove moves[JOURNAL_CAPACITY];
+    int count;
+} MoveJournal;
+/* A transposition table slot. The check word is the key xor the data, so a slot half written by another thread never matches. */
+typedef struct {
+    atomic_ullong check;
+    atomic_ullong data;
+} TableEntry;
+/* A transposition table, shared by all threads searching for the same engine. */
+typedef struct {
+    TableEntry* entries;
+    unsigned long long mask;
+} TranspositionTable;
+/* Settings of the computer player, they can be changed from the command line. */
+typedef struct {
+    int depth;          /* How many moves ahead the midgame search looks, 0 just takes the most flips. */
+    int endgameEmpties; /* Solve the rest of the game exactly once this few cells are empty. */
+    int threads;        /* How many threads share the search. */
+    int playouts;       /* Playouts per move of the Monte Carlo tree search, 0 searches with alpha-beta instead. */
+    double timeLimit;   /* Seconds the alpha-beta searches may take per move, 0 for no limit. */
+    TranspositionTable* table; /* What the engine remembers between searches. */
+    struct MctsTree* tree;     /* The Monte Carlo tree, kept from one move to the next. */
+} EngineConfig;
+/* What the program was asked to do. */
+typedef enum {
+    MODE_PLAY,
+    MODE_BENCHMARK,
+    MODE_GENERATE,
+    MODE_TRAIN,
+    MODE_BOOK,
+    MODE_TOURNAMENT,
+    MODE_ANALYZE,
+    MODE_IMPORT,
+    MODE_QUERY
+} ProgramMode;
+/* Everything the command line says besides the engine settings. */
+typedef struct {
+    ProgramMode mode;
+    int size;                     /* Board size for the offline modes. */
+    int count;                    /* Games to play or book depth in moves. */
+    const char* fileName;
+    const char* databaseName;     /* Game database to import into or to query. */
+    const char* engineSpecs[2];   /* The two engines of a tournament, as "depth/endgame". */
+    unsigned long long seed;      /* Seed of the random openings. */
+    int treeMemory;               /* Megabytes of each Monte Carlo tree, 0 for the default of the mode. */
+} ProgramOptions;
+/* A pattern instance a cell belongs to, and the power of 3 of its digit in the instance's index. */
+typedef struct {
+    short instance;
+    short power;
+} PatternRef;
+/* Pattern evaluation for one board size. Every pattern instance reads its cells as a base 3 number
+   (0 empty, 1 computer, 2 user) and looks the number up in its type's table for the game phase. */
+typedef struct {
+    int size;
+    int instanceCount;
+    int instanceType[MAX_PATTERNS];
+    PatternRef refs[MAX_CELLS][MAX_PATTERN_REFS];
+    int refCount[MAX_CELLS];
+    float weights[PATTERN_PHASES][PATTERN_TYPES][PATTERN_TABLE_SIZE]; /* Predicted final disc difference, computer minus user. */
+} PatternSet;
+/* One thread's private copy of the game, played forward and back by the searches. */
+typedef struct {
+    Board board;
+    CellSet sets[4];              /* The cells of each CellState, kept up to date with the board. */
+    int discs[3];                 /* Disc count of each player, indexed by CellState. */
+    Position empties[MAX_CELLS];  /* The empty cells left when the search started. */
+    int emptyCount;
+    int parity;                   /* One bit per board quarter, set if it has an odd number of empties. */
+    unsigned long long hash;      /* Zobrist key of the discs on the board. */
+    int weights[MAX_SIZE][MAX_SIZE]; /* How much each cell is worth to the evaluation. */
+    const PatternSet* patterns;   /* Trained pattern weights for this size, NULL if there are none. */
+    int patternIndex[MAX_PATTERNS]; /* Kept up to date as discs are placed and flipped. */
+    MoveJournal journal;          /* The moves of the current line, so they can be taken back. */
+    MoveCache legalMoves;         /* Both players' legal moves in the current position. */
+    bool cacheMoves;              /* Off in the endgame, where rescanning the few empties is cheaper than updating the cache. */
+    TranspositionTable* table;
+    long long nodes;
+    Line pv[MAX_PLY + 1];         /* pv[ply] is the best line found from the node ply moves into the search. */
+    double deadline;              /* wallClock() time the search must stop at, 0 for none. */
+    bool aborted;                 /* The search must unwind, every score since then is worthless. */
+    bool outOfTime;               /* It must because the deadline passed. */
+    struct SearchPool* pool;      /* The threads of the search, NULL for none. */
+    struct SplitPoint* split;     /* The split point whose moves this state is searching, NULL for none. */
+} SearchState;
+/* A node whose younger moves are shared between threads. The thread that searched its eldest move opens it,
+   idle helpers join and take the moves one at a time. Everything but the atomics is guarded by the lock of the pool. */
+typedef struct SplitPoint {
+    Board board;                /* The position at the node, helpers start their search states from it. */
+    CellState player;
+    const Position* moves;      /* The younger moves, in order. */
+    int moveCount;
+    int depth;                  /* Midgame depth left after the move, -1 to solve the game to the end. */
+    bool cacheMoves;
+    int beta;
+    atomic_int next;            /* Index of the next move nobody has taken yet. */
+    atomic_int alpha;           /* The node's alpha, raised by every move that beats it. */
+    atomic_bool cutoff;         /* A move reached beta, the moves still being searched are worthless. */
+    int best;
+    int bestMove;               /* row * MAX_SIZE + col of the move that scored best. */
+    Line pv;                    /* The line of the node, as far as the moves searched so far go. */
+    int helpers;                /* Threads besides the owner searching its moves. */
+    bool outOfTime;             /* A helper passed the deadline. */
+    struct SplitPoint* parent;  /* The split point the owner was working under, NULL at the root. */
+    struct SplitPoint* nextOpen;
+} SplitPoint;
+/* The helper threads of one search and the split points they may join. */
+typedef struct SearchPool {
+    TranspositionTable* table;
+    double deadline;
+    pthread_mutex_t lock;
+    pthread_cond_t wake;        /* A split point opened, or the search is over. */
+    pthread_cond_t finished;    /* A split point lost its last helper. */
+    SplitPoint* open;           /* Split points helpers may still join, newest first. */
+    atomic_int idle;            /* Helpers waiting for work. Nodes below the root only split if one is. */
+    atomic_llong nodes;         /* Nodes the helpers searched. */
+    bool done;
+} SearchPool;
+/* A node of the Monte Carlo tree. The threads update the counters without locks, the children are allocated next to each other. */
+typedef struct {
+    atomic_int visits;
+    atomic_int wins;          /* Half points of the player who moved into the node: 2 for a win, 1 for a draw. */
+    atomic_int virtualLoss;   /* Threads below the node right now. */
+    atomic_int state;         /* NODE_LEAF, NODE_EXPANDING or NODE_EXPANDED. */
+    int firstChild;           /* Index of the first child in the arena. */
+    short childCount;         /* 0 for an expanded node means the game is over there. */
+    short move;               /* Flat board cell of the move that leads here, -1 for a pass. */
+} TreeNode;
+/* States of a TreeNode. Only the thread that moves a node from leaf to expanding writes its children. */
+enum {
+    NODE_LEAF,
+    NODE_EXPANDING,
+    NODE_EXPANDED
+};
+/* The Monte Carlo tree of one engine. Nodes come from a fixed arena and are never freed one by one:
+   between moves the subtree that is still useful is copied to the spare arena and the two are swapped. */
+typedef struct MctsTree {
+    TreeNode* nodes;
+    TreeNode* spare;
+    int capacity;             /* Nodes in each arena. */
+    atomic_int used;
+    Board board;              /* The position at the root. */
+    CellState player;         /* Who moves at the root. */
+    bool valid;               /* False until the first search. */
+} MctsTree;
+/* One position of the opening book, in the orientation whose key is the smallest of the 8 board symmetries. */
+typedef struct {
+    unsigned long long key;
+    short move;  /* row * MAX_SIZE + col, in the same orientation as the key. */
+    short score;
+    int depth;
+} BookEntry;
+/* Header of a book file, the entries follow sorted by key. */
+typedef struct {
+    int magic;
+    int size;
+    int count;
+    int depth;
+} BookHeader;
+/* Header of a game database file. The games follow, then their moves and then the position index, sorted by key. */
+typedef struct {
+    int magic;
+    unsigned int gameCount;
+    long long moveBytes;      /* Padded so the index starts on a multiple of 8 bytes. */
+    long long indexCount;
+} DatabaseHeader;
+/* A game of the database. Its moves are one byte each, row * size + col, or two bytes on boards of more than 256 cells.
+   Passes are not stored, they follow from the position. */
+typedef struct {
+    unsigned int offset;      /* Where the game's moves start. */
+    unsigned short moveCount;
+    unsigned char size;
+    short result;             /* Final discs of the side that moved first minus the other side's. */
+} GameEntry;
+/* An entry of the position index: a position, by the key that is the same for all 8 of its symmetric copies, and where it was reached. */
+typedef struct {
+    unsigned long long key;
+    unsigned int game;
+    unsigned int ply;         /* Moves played before it, passes not counted. */
+} PositionEntry;
+/* A database mapped into memory. */
+typedef struct {
+    const DatabaseHeader* header;
+    const GameEntry* games;
+    const unsigned char* moves;
+    const PositionEntry* index;
+    size_t bytes;
+} GameDatabase;
+/* The hash keys of every cell and state in each of the 8 orientations of one board size. */
+typedef unsigned long long SymmetricKeys[8][MAX_CELLS][3];
 
-CellState** allocateBoard(int size);
-void freeBoard(CellState** board, int size);
-void initializeBoard(CellState** board, int size);
-void displayBoard(CellState** board, int size);
-bool isValidMove(CellState** board, int size, Position pos, CellState player);
-int makeMove(CellState** board, int size, Position pos, CellState player);
-Position getUserMove(CellState** board, int size);
-Position getComputerMove(CellState** board, int size);
-bool hasValidMoves(CellState** board, int size, CellState player);
-void countCells(CellState** board, int size, int* computerCount, int* userCount);
+Board* allocateBoard(int size);
+void freeBoard(Board* board);
+void initializeBoard(Board* board);
+void displayBoard(Board* board);
+bool isValidMove(Board* board, Position pos, CellState player);
+int makeMove(Board* board, Position pos, CellState player);
+int playMove(Board* board, MoveJournal* journal, Position pos, CellState player);
+void recordPass(MoveJournal* journal, CellState player);
+bool undoMove(Board* board, MoveJournal* journal, JournalMove* undone);
+bool undoTurn(Board* board, MoveJournal* journal, MoveCache* legalMoves);
+void computeMoveCache(Board* board, MoveCache* cache);
+void refreshMoveCache(Board* board, MoveCache* cache, int row, int col);
+void updateMoveCache(Board* board, MoveCache* cache, const JournalMove* move);
+Position getUserMove(Board* board, const MoveCache* legalMoves);
+Position getComputerMove(Board* board, CellState player, const EngineConfig* config);
+bool hasValidMoves(Board* board, CellState player);
+void countCells(Board* board, int* computerCount, int* userCount);
 void printGameResult(int computerCount, int userCount);
+void boardSets(Board* board, CellSet* sets);
+void shiftSet(const CellSet* set, int shift, int words, CellSet* result);
+int countSet(const CellSet* set);
+void findStable(const CellSet* sets, int size, int* computerStable, int* userStable);
+void stableDiscs(Board* board, int* computerStable, int* userStable);
+void printScoreBounds(Board* board);
 int getBoardSize(void);
 Position parseMove(const char* input);
 bool isValidPosition(int size, Position pos);
-int countFlips(CellState** board, int size, Position pos, CellState player);
-void flipCells(CellState** board, int size, Position pos, CellState player);
-int checkDirection(CellState** board, int size, Position pos, CellState player, int dRow, int dCol, bool flip);
+int countFlips(Board* board, Position pos, CellState player);
+void flipCells(Board* board, Position pos, CellState player);
+int checkDirection(Board* board, int cell, CellState player, int step, bool flip);
+bool parseArguments(int argc, char* argv[], EngineConfig* config, ProgramOptions* options);
+int countEmpties(Board* board);
+CellState opponentOf(CellState player);
+unsigned long long nextRandom(unsigned long long* state);
+void initZobrist(void);
+bool initTable(TranspositionTable* table, int bits);
+void clearTable(TranspositionTable* table);
+void freeTable(TranspositionTable* table);
+bool probeTable(TranspositionTable* table, unsigned long long key, int* depth, int* bound, int* score, int* move);
+void storeTable(TranspositionTable* table, unsigned long long key, int depth, int bound, int score, int move);
+void initSearch(SearchState* state, Board* board);
+int quarterOf(const SearchState* state, Position pos);
+int searchPlay(SearchState* state, Position pos, CellState player);
+void searchUndo(SearchState* state);
+void searchUpdateFlips(SearchState* state, const JournalMove* move, int sign);
+void toggleCell(CellSet* sets, int cell, CellState from, CellState to);
+void searchStable(SearchState* state, CellState player, int* playerStable, int* opponentStable);
+int searchMobility(SearchState* state, CellState player);
+bool searchIsLegal(SearchState* state, Position pos, CellState player);
+bool searchStopped(SearchState* state);
+void updateLine(SearchState* state, Position move);
+void addPassToLine(SearchState* state, CellState opponent);
+int searchRoot(Board* board, CellState player, Position* moves, int moveCount, int depth, const EngineConfig* config, double deadline,
+               Position* bestPos, Line* pv, long long* nodes);
+bool helperIdle(SearchState* state);
+bool splitCutOff(const SplitPoint* split);
+void searchSplit(SearchState* state, CellState player, const Position* moves, int moveCount, int depth, int alpha, int beta,
+                 int* best, int* bestMove);
+void searchSplitMoves(SearchState* state, SplitPoint* split);
+void* searchHelper(void* arg);
+Position solveEndgame(Board* board, CellState player, const EngineConfig* config, double deadline, int* score, Line* pv);
+int orderEndgameMoves(SearchState* state, CellState player, Position* moves);
+int solveLastEmpty(SearchState* state, CellState player);
+int solveNode(SearchState* state, CellState player, int alpha, int beta, bool passed);
+Position searchMidgame(Board* board, CellState player, const EngineConfig* config, double deadline, int* score, Line* pv, long long* nodes);
+int orderMidgameMoves(SearchState* state, CellState player, Position* moves, int hintMove);
+int evaluatePosition(SearchState* state, CellState player);
+int finalScore(const SearchState* state, CellState player);
+int searchNode(SearchState* state, CellState player, int depth, int alpha, int beta, bool passed);
+bool initTree(MctsTree* tree, int megabytes);
+void freeTree(MctsTree* tree);
+void legalMoveSet(const CellSet* sets, CellState player, int words, CellSet* moves);
+int nthCell(const CellSet* set, int words, int n);
+void playCell(Board* board, CellSet* sets, int cell, CellState player);
+CellState randomPlayout(Board* board, CellSet* sets, CellState player, int words, unsigned long long* seed);
+int findReusedNode(MctsTree* tree, int node, Board* board, CellState player, Board* position, CellState toMove, int plies);
+void keepSubtree(MctsTree* tree, int node);
+bool expandNode(MctsTree* tree, int node, CellSet* sets, CellState player, int words);
+int selectChild(MctsTree* tree, int node);
+Position searchMcts(Board* board, CellState player, const EngineConfig* config, double* winRate);
+void* mctsWorker(void* arg);
+void playRandomOpening(Board* board, int moves, unsigned long long* seed);
+double wallClock(void);
+void runBenchmark(const EngineConfig* config);
+PatternSet* createPatterns(int size);
+void patternWeightsFile(int size, char* name, int length);
+bool loadPatterns(int size);
+bool savePatterns(const PatternSet* set);
+int patternPhase(int size, int empties);
+void computePatternIndices(const PatternSet* set, Board* board, int* indices);
+void updatePatterns(SearchState* state, Position pos, int delta);
+int patternScore(const PatternSet* set, const int* indices, int phase);
+int playEngineGame(Board* board, const EngineConfig* const* engines, unsigned long long* seed, Position* moves, double* moveTimes);
+bool generateGames(const EngineConfig* config, int size, int games, unsigned long long seed, const char* fileName);
+int readGameRecord(FILE* file, int* size, Position* moves, int maxMoves);
+bool trainPatterns(const char* fileName);
+Position transformCell(int size, int symmetry, Position pos);
+Position untransformCell(int size, int symmetry, Position pos);
+unsigned long long canonicalKey(Board* board, CellState player, int* symmetry);
+void bookFile(int size, char* name, int length);
+bool openBook(int size);
+void closeBook(void);
+bool bookMove(Board* board, CellState player, Position* pos);
+bool buildBook(const EngineConfig* config, int size, int plies);
+bool parseEngine(const char* spec, EngineConfig* engine);
+void* tournamentWorker(void* arg);
+double eloFromScore(double score);
+int compareTimes(const void* a, const void* b);
+void printMoveTimes(const char* name, double* times, int count);
+bool runTournament(const EngineConfig* config, const ProgramOptions* options);
+bool parsePosition(const char* text, Board* board, CellState* player);
+void formatLine(const Line* line, char* text, int length);
+void* analysisWorker(void* arg);
+bool runAnalysis(const EngineConfig* config, const ProgramOptions* options);
+int parseGameText(const char* text, int* size, Position* moves, int maxMoves);
+void buildSymmetricKeys(int size, SymmetricKeys* keys);
+unsigned long long smallestKey(const unsigned long long* orientations, CellState player);
+bool reserveItems(void** items, size_t* capacity, size_t needed, size_t itemSize);
+bool sortPositions(PositionEntry* entries, size_t count);
+bool importGames(const char* recordName, const char* databaseName);
+bool openDatabase(const char* name, GameDatabase* database);
+void closeDatabase(GameDatabase* database);
+size_t findPositions(const GameDatabase* database, unsigned long long key, size_t* first);
+Position gameMove(const GameDatabase* database, const GameEntry* game, int k);
+bool queryDatabase(const char* databaseName, const char* queryName);
 
 
 //All possible moves in an array.
 const int directions[8][2] = {{-1,-1}, {-1,0}, {-1,1}, {0,-1}, {0,1}, {1,-1}, {1,0}, {1,1}};
+/* The same directions as steps through the flat board. */
+const int directionSteps[8] = {-BOARD_STRIDE - 1, -BOARD_STRIDE, -BOARD_STRIDE + 1, -1, 1, BOARD_STRIDE - 1, BOARD_STRIDE, BOARD_STRIDE + 1};
+
+/* Random keys for hashing positions: one per cell and player, one per board size and one for the side to move. */
+unsigned long long zobristCells[MAX_CELLS][3];
+unsigned long long zobristSizes[MAX_SIZE + 1];
+unsigned long long zobristSide;
+
+/* The transposition table of the computer player. */
+TranspositionTable sharedTable;
+
+/* The Monte Carlo tree of the computer player, when it plays by playouts. */
+MctsTree computerTree;
 
-int main() {
+/* Trained pattern weights, loaded for the board size being played. */
+PatternSet* patterns;
+
+/* The opening book, mapped straight from its file. */
+const BookEntry* bookEntries;
+int bookCount;
+size_t bookBytes;
+
+int main(int argc, char* argv[]) {
+    EngineConfig config;
+    ProgramOptions options;
     int size;
-    CellState** board;
+    Board* board;
     CellState currentPlayer;
+    MoveJournal* journal;
+    MoveCache* legalMoves;
     bool gameRunning;
     int computerCount, userCount;
     
+    /* Read the computer player settings, if any were given. */
+    if (!parseArguments(argc, argv, &config, &options)) {
+        return 1;
+    }
+    
+    /* The searches need the hash keys and the shared table. */
+    initZobrist();
+    if (!initTable(&sharedTable, TABLE_BITS)) {
+        printf("Memory allocation failed!\n");
+        return 1;
+    }
+    config.table = &sharedTable;
+    if (config.playouts > 0) {
+        if (!initTree(&computerTree, options.treeMemory > 0 ? options.treeMemory : TREE_DEFAULT_MEMORY)) {
+            printf("Memory allocation failed!\n");
+            return 1;
+        }
+        config.tree = &computerTree;
+    }
+    
+    if (options.mode == MODE_BENCHMARK) {
+        runBenchmark(&config);
+        return 0;
+    }
+    if (options.mode == MODE_GENERATE) {
+        loadPatterns(options.size);
+        return generateGames(&config, options.size, options.count, options.seed, options.fileName) ? 0 : 1;
+    }
+    if (options.mode == MODE_TRAIN) {
+        return trainPatterns(options.fileName) ? 0 : 1;
+    }
+    if (options.mode == MODE_BOOK) {
+        loadPatterns(options.size);
+        return buildBook(&config, options.size, options.count) ? 0 : 1;
+    }
+    if (options.mode == MODE_TOURNAMENT) {
+        loadPatterns(options.size);
+        return runTournament(&config, &options) ? 0 : 1;
+    }
+    if (options.mode == MODE_IMPORT) {
+        return importGames(options.fileName, options.databaseName) ? 0 : 1;
+    }
+    if (options.mode == MODE_QUERY) {
+        return queryDatabase(options.databaseName, options.fileName) ? 0 : 1;
+    }
+    if (options.mode == MODE_ANALYZE) {
+        loadPatterns(options.size);
+        return runAnalysis(&config, &options) ? 0 : 1;
+    }
+    
     printf("Welcome to Reversi!\n\n");
     
     /* Get the board size.*/
     size = getBoardSize();
     
-    /* Create board warn if cannot.*/
+    /* Trained weights are used if there are any for this size. */
+    if (loadPatterns(size)) {
+        printf("Using the trained evaluation for %dx%d.\n", size, size);
+    }
+    if (openBook(size)) {
+        printf("Using an opening book of %d positions.\n", bookCount);
+    }
+    
+    /* Create board warn if cannot. The journal keeps the moves for undo.*/
     board = allocateBoard(size);
-    if (!board) {
+    journal = (MoveJournal*)malloc(sizeof(MoveJournal));
+    legalMoves = (MoveCache*)malloc(sizeof(MoveCache));
+    if (!board || !journal || !legalMoves) {
         printf("Memory allocation failed!\n");
         return 1;
     }
+    journal->count = 0;
     
     /* The game reversi always starts with XO  layup in the beginng (it's more like black white white black) so the board is initialized with that.
                                            OX  */
-    initializeBoard(board, size);
+    initializeBoard(board);
+    
+    /* Both players' legal moves are found once here, after that every move only updates the cells it can affect. */
+    computeMoveCache(board, legalMoves);
     
     /* The variable currentPlayer keeps track of the player who moves at the moment. Game always start with the user */
     currentPlayer = USER; /* User starts */
@@ -75,19 +547,31 @@ int main() {
         int flipped;
         
         /* Displays the current board by printing the array in the dynamic memory.*/
-        displayBoard(board, size);
+        displayBoard(board);
+        printScoreBounds(board);
         
         if (currentPlayer == USER) {
             /* If the player is making the move the program checks if the move is valid for example, it checks if the move is out of bounds etc. */
-            if (hasValidMoves(board, size, USER)) {
+            if (legalMoves->count[USER] > 0) {
                 printf("\nYour turn (O):\n");
-                userPos = getUserMove(board, size);
-                flipped = makeMove(board, size, userPos, USER); /* The program calculates the amount of cells captured.*/
+                userPos = getUserMove(board, legalMoves);
+                if (userPos.row == UNDO_MOVE) {
+                    /* The user's last move and everything after it are taken back, it is the user's turn again. */
+                    if (undoTurn(board, journal, legalMoves)) {
+                        printf("Your last move was taken back.\n");
+                    } else {
+                        printf("No moves to undo!\n");
+                    }
+                    continue;
+                }
+                flipped = playMove(board, journal, userPos, USER); /* The program calculates the amount of cells captured.*/
+                updateMoveCache(board, legalMoves, &journal->moves[journal->count - 1]);
                 printf("You captured %d cell(s).\n", flipped);
                 currentPlayer = COMPUTER; /* Computer gets the opportunity.*/
             } else {
                 printf("You have no valid moves. Skipping your turn.\n"); /* To not get stuck in an unending board the program checks whether the player has a valid move or not and moves on automatically if not.*/
-                if (!hasValidMoves(board, size, COMPUTER)) {
+                recordPass(journal, USER);
+                if (legalMoves->count[COMPUTER] == 0) {
                     gameRunning = false; /* If both players have no valid moves, the game ends. */
                     printf("Both players have no valid moves. Game over.\n");
                 } else {
@@ -96,17 +580,19 @@ int main() {
             }
         } else {
             /* Computer's turn */ /* Same algorithm as mentioned above */
-            if (hasValidMoves(board, size, COMPUTER)) {
+            if (legalMoves->count[COMPUTER] > 0) {
                 printf("\nComputer's turn (X):\n");
-                computerPos = getComputerMove(board, size);
-                flipped = makeMove(board, size, computerPos, COMPUTER);
+                computerPos = getComputerMove(board, COMPUTER, &config);
+                flipped = playMove(board, journal, computerPos, COMPUTER);
+                updateMoveCache(board, legalMoves, &journal->moves[journal->count - 1]);
                 printf("Computer plays %c%d and captures %d cell(s).\n", 
                        'a' + computerPos.col, computerPos.row + 1, flipped);
-                       displayBoard(board, size); /* Displays the board after the computer's move. */
+                       displayBoard(board); /* Displays the board after the computer's move. */
                 currentPlayer = USER;
             } else {
                 printf("Computer has no valid moves. Skipping computer's turn.\n");
-                if (!hasValidMoves(board, size, USER)) {
+                recordPass(journal, COMPUTER);
+                if (legalMoves->count[USER] == 0) {
                     gameRunning = false;
                 } else {
                     currentPlayer = USER;
@@ -120,82 +606,68 @@ int main() {
     }
     
     /* The final board is shown.*/
-    displayBoard(board, size);
+    displayBoard(board);
     
     /* Scores get counted.*/
-    countCells(board, size, &computerCount, &userCount);
+    countCells(board, &computerCount, &userCount);
     printGameResult(computerCount, userCount);
     
     /* Release the allocated memory.*/
-    freeBoard(board, size);
+    freeBoard(board);
+    free(journal);
+    free(legalMoves);
+    closeBook();
+    freeTable(&sharedTable);
+    freeTree(&computerTree);
     
     return 0;
 }
 
-/* Creates the board dynamically. */
-CellState** allocateBoard(int size) {
-    CellState** board;
-    int i, j;
+/* Creates the board dynamically, in one block whatever its size. */
+Board* allocateBoard(int size) {
+    Board* board;
     
     /* This is the main board.*/
-    board = (CellState**)malloc(size * sizeof(CellState*));
+    board = (Board*)malloc(sizeof(Board));
     if (!board) {
         return NULL;
     }
-    
-    for (i = 0; i < size; i++) {
-        board[i] = (CellState*)calloc(size, sizeof(CellState)); 
-        if (!board[i]) {
-            /* If not functioning properly the program frees the memory and ends the game..*/
-            for (j = 0; j < i; j++) {
-                free(board[j]);
-            }
-            /* The board gets cleaned so the game can start from scratch.*/
-            free(board);
-            return NULL;
-        }
-    }
+    board->size = size;
+    initializeBoard(board);
     return board;
 }
 
 /* The function to free the memory allocated for the board. */
-void freeBoard(CellState** board, int size) {
-    int i;
-    
-    if (!board) {
-        return;
-    }
-    
-    /* lines get freed one by one. */
-    for (i = 0; i < size; i++) {
-        free(board[i]);
-    }
+void freeBoard(Board* board) {
     free(board);
 }
 
 /* As I mentioned before we have to start the board in a spesific way because of the rules of the game reversi. We do that here. */
-void initializeBoard(CellState** board, int size) {
+void initializeBoard(Board* board) {
+    int size = board->size;
     int i, j;
     int center;
     
-    /* Empty all the cells*/
+    /* Wall everywhere, then empty all the cells inside the border. */
+    memset(board->cells, WALL, sizeof(board->cells));
     for (i = 0; i < size; i++) {
         for (j = 0; j < size; j++) {
-            board[i][j] = EMPTY;
+            board->cells[CELL(i, j)] = EMPTY;
         }
     }
     
     center = size / 2;
     
     /* We place the necessary cells to start the game. */
-    board[center - 1][center - 1] = COMPUTER; /* An X for the left top corner of the center. */
-    board[center - 1][center] = USER;         /* An O for the right top corner of the center. */
-    board[center][center - 1] = USER;         /* An X for the left bottom corner of the center. */
-    board[center][center] = COMPUTER;         /* An O for the right bottom corner of the center.X */
+    board->cells[CELL(center - 1, center - 1)] = COMPUTER; /* An X for the left top corner of the center. */
+    board->cells[CELL(center - 1, center)] = USER;         /* An O for the right top corner of the center. */
+    board->cells[CELL(center, center - 1)] = USER;         /* An X for the left bottom corner of the center. */
+    board->cells[CELL(center, center)] = COMPUTER;         /* An O for the right bottom corner of the center.X */
 }
 
 /* The function to print the board. */
-void displayBoard(CellState** board, int size) {
+void displayBoard(Board* board) {
+    int size = board->size;
     int i, j;
     char cell;
     
@@ -211,9 +683,9 @@ void displayBoard(CellState** board, int size) {
         printf("%d ", i + 1); /* Keep track of the rows. */
         for (j = 0; j < size; j++) {
             /* Cell info is checked and placed accordingly. */
-            if (board[i][j] == EMPTY) {
+            if (board->cells[CELL(i, j)] == EMPTY) {
                 cell = '.';
-            } else if (board[i][j] == COMPUTER) {
+            } else if (board->cells[CELL(i, j)] == COMPUTER) {
                 cell = 'X';
             } else {
                 cell = 'O';
@@ -298,16 +770,24 @@ bool isValidPosition(int size, Position pos) {
 }
 
 /* get the user move. */
-Position getUserMove(CellState** board, int size) {
+Position getUserMove(Board* board, const MoveCache* legalMoves) {
+    int size = board->size;
     char input[10];
     Position pos;
     
     while (1) {
-        printf("Enter your move (e.g., d3): ");
+        printf("Enter your move (e.g., d3) or 'undo': ");
         if (scanf("%9s", input) != 1) { 
             continue;
         }
         
+        /* The game loop takes care of the undo. */
+        if (strcmp(input, "undo") == 0) {
+            pos.row = UNDO_MOVE;
+            pos.col = UNDO_MOVE;
+            break;
+        }
+        
         /* Parse it into an actual move. */
         pos = parseMove(input);
         
@@ -318,13 +798,13 @@ Position getUserMove(CellState** board, int size) {
         }
         
         /* If the move is valid then checks if the desired cell is empty or not. */
-        if (board[pos.row][pos.col] != EMPTY) {
+        if (board->cells[CELL(pos.row, pos.col)] != EMPTY) {
             printf("Position already occupied.\n");
             continue;
         }
         
-        /* Checks if the move is appropriate or not. */
-        if (!isValidMove(board, size, pos, USER)) {
+        /* Checks if the move is appropriate or not, the cache already knows. */
+        if (!legalMoves->legal[USER][pos.row][pos.col]) {
             printf("Invalid move. You must capture at least one opponent piece.\n");
             continue;
         }
@@ -336,17 +816,17 @@ Position getUserMove(CellState** board, int size) {
 }
 
 /* The function that checks whether the move is valid or not, just mentioned before. */
-bool isValidMove(CellState** board, int size, Position pos, CellState player) {
+bool isValidMove(Board* board, Position pos, CellState player) {
     /* Is the position available? */
-    if (!isValidPosition(size, pos)) {
+    if (!isValidPosition(board->size, pos)) {
         return false;
     }/* Is the cell empty? */
-    if (board[pos.row][pos.col] != EMPTY) {
+    if (board->cells[CELL(pos.row, pos.col)] != EMPTY) {
         return false;
     }
     
     /* Can you flip at least one stone? */
-    if (countFlips(board, size, pos, player) > 0) {
+    if (countFlips(board, pos, player) > 0) {
         return true;
     } else {
         return false;
@@ -354,26 +834,27 @@ bool isValidMove(CellState** board, int size, Position pos, CellState player) {
 }
 
 /* Where we actually keep count of the cells flipped by a move. */
-int countFlips(CellState** board, int size, Position pos, CellState player) {
+int countFlips(Board* board, Position pos, CellState player) {
     int totalFlips;
+    int cell;
     int i;
     
     totalFlips = 0;
+    cell = CELL(pos.row, pos.col);
     
     /* Checks every single direction by a for loops, and increases the flip count if it fits. */
     for (i = 0; i < 8; i++) {
-        totalFlips += checkDirection(board, size, pos, player, 
-                                   directions[i][0], directions[i][1], false);
+        totalFlips += checkDirection(board, cell, player, directionSteps[i], false);
     }
     
     return totalFlips;
 }
 
-int checkDirection(CellState** board, int size, Position pos, CellState player, 
-                  int dRow, int dCol, bool flip) {
-    CellState opponent;
+/* Walks from cell in steps of step through the flat board. The border is WALL, so the walk stops there without any bounds checks. */
+int checkDirection(Board* board, int cell, CellState player, int step, bool flip) {
+    unsigned char opponent;
     int flips;
-    int row, col;
+    int next;
     int i;
     
     /* Decide who is the opponent. */
@@ -384,62 +865,239 @@ int checkDirection(CellState** board, int size, Position pos, CellState player,
     }
     
     flips = 0;
-    row = pos.row + dRow;
-    col = pos.col + dCol;
+    next = cell + step;
     
-    /* Checks the direction (line by line) and increases the flip count if there is a enemy cell. Also incrases the position so we do not get stuck in a infinite loop. */
-    while (row >= 0 && row < size && col >= 0 && col < size && 
-           board[row][col] == opponent) {
+    /* Checks the direction (line by line) and increases the flip count if there is a enemy cell. */
+    while (board->cells[next] == opponent) {
         flips++;
-        row += dRow;
-        col += dCol;
+        next += step;
     }
     
-    /* If the move is out of bounds it is not accepted. */
-    if (row < 0 || row >= size || col < 0 || col >= size || 
-        board[row][col] != player) {
+    /* The line must end with one of the player's discs, not an empty cell or the wall. */
+    if (board->cells[next] != player) {
         return 0;
     }
     
     /* But if the flip flag is 1 and you can actually flip some cells then the program actually does the considered changes on the board. */
-    if (flip && flips > 0) {
-        row = pos.row + dRow;
-        col = pos.col + dCol;
+    if (flip) {
+        next = cell + step;
         for (i = 0; i < flips; i++) {
-            board[row][col] = player;
-            row += dRow;
-            col += dCol;
+            board->cells[next] = (unsigned char)player;
+            next += step;
         }
     }
     
     return flips;
 }
 
-/* Makes the moves happen. */
-int makeMove(CellState** board, int size, Position pos, CellState player) {
+/* Makes the moves happen, when nobody needs to take them back. */
+int makeMove(Board* board, Position pos, CellState player) {
+    return playMove(board, NULL, pos, player);
+}
+
+/* Plays a move and, if there is a journal, writes down how many discs it flipped in each direction so undoMove can take it back.
+   Returns the number of flipped cells. An illegal move, or one that does not fit in the journal, changes nothing and returns 0. */
+int playMove(Board* board, MoveJournal* journal, Position pos, CellState player) {
+    JournalMove* entry;
+    JournalMove scratch;
     int totalFlipped;
+    int cell;
     int i;
     
-    totalFlipped = 0;
+    if (journal && journal->count == JOURNAL_CAPACITY) {
+        return 0;
+    }
+    entry = journal ? &journal->moves[journal->count] : &scratch;
     
-    /* This function actually places the player cell. */
-    board[pos.row][pos.col] = player;
+    /* We use the same function before to reach all 8 directions, first only counting. */
+    totalFlipped = 0;
+    cell = CELL(pos.row, pos.col);
+    for (i = 0; i < 8; i++) {
+        entry->rays[i] = (unsigned char)checkDirection(board, cell, player, directionSteps[i], false);
+        totalFlipped += entry->rays[i];
+    }
+    if (totalFlipped == 0) {
+        return 0;
+    }
     
-    /* We use the same function before to reach all 8 directions and flip the necessary ones. */
+    /* This function actually places the player cell and flips the necessary ones. */
+    board->cells[cell] = (unsigned char)player;
     for (i = 0; i < 8; i++) {
-        totalFlipped += checkDirection(board, size, pos, player, directions[i][0], directions[i][1], true);
-                                     
+        if (entry->rays[i] > 0) {
+            checkDirection(board, cell, player, directionSteps[i], true);
+        }
     }
     
+    if (journal) {
+        entry->pos = pos;
+        entry->player = player;
+        journal->count++;
+    }
     return totalFlipped;
 }
 
-/*(ALWAYS CHOOSES THE MOVE WITH THE BIGGEST NUMBER OF FLIPS.)  */
-Position getComputerMove(CellState** board, int size) {
+/* Writes down that player had to pass, so an undo gives the turn back correctly. */
+void recordPass(MoveJournal* journal, CellState player) {
+    if (journal->count == JOURNAL_CAPACITY) {
+        return;
+    }
+    journal->moves[journal->count].pos.row = -1;
+    journal->moves[journal->count].pos.col = -1;
+    journal->moves[journal->count].player = player;
+    journal->count++;
+}
+
+/* Takes back the newest move of the journal: the flipped discs go back to the opponent and the cell is emptied.
+   The move is copied to undone if it is not NULL. Returns false if the journal is empty. */
+bool undoMove(Board* board, MoveJournal* journal, JournalMove* undone) {
+    JournalMove* entry;
+    CellState opponent;
+    int cell, i, k;
+    
+    if (journal->count == 0) {
+        return false;
+    }
+    entry = &journal->moves[--journal->count];
+    if (undone) {
+        *undone = *entry;
+    }
+    if (entry->pos.row < 0) {
+        return true; /* A pass changed nothing on the board. */
+    }
+    
+    opponent = opponentOf(entry->player);
+    for (i = 0; i < 8; i++) {
+        cell = CELL(entry->pos.row, entry->pos.col);
+        for (k = 0; k < entry->rays[i]; k++) {
+            cell += directionSteps[i];
+            board->cells[cell] = (unsigned char)opponent;
+        }
+    }
+    board->cells[CELL(entry->pos.row, entry->pos.col)] = EMPTY;
+    return true;
+}
+
+/* Takes back the user's last move and whatever came after it, keeping the legal moves in step. Returns false if the user has not moved yet. */
+bool undoTurn(Board* board, MoveJournal* journal, MoveCache* legalMoves) {
+    JournalMove undone;
+    int last;
+    
+    for (last = journal->count - 1; last >= 0; last--) {
+        if (journal->moves[last].player == USER && journal->moves[last].pos.row >= 0) {
+            break;
+        }
+    }
+    if (last < 0) {
+        return false;
+    }
+    while (journal->count > last) {
+        undoMove(board, journal, &undone);
+        updateMoveCache(board, legalMoves, &undone);
+    }
+    return true;
+}
+
+/* Finds both players' legal moves from scratch. */
+void computeMoveCache(Board* board, MoveCache* cache) {
+    int i, j;
+    
+    memset(cache, 0, sizeof(MoveCache));
+    for (i = 0; i < board->size; i++) {
+        for (j = 0; j < board->size; j++) {
+            refreshMoveCache(board, cache, i, j);
+        }
+    }
+}
+
+/* Checks one cell again for both players. */
+void refreshMoveCache(Board* board, MoveCache* cache, int row, int col) {
+    Position pos;
+    bool legal;
+    int player;
+    
+    pos.row = row;
+    pos.col = col;
+    for (player = COMPUTER; player <= USER; player++) {
+        legal = board->cells[CELL(row, col)] == EMPTY && countFlips(board, pos, (CellState)player) > 0;
+        if (legal != cache->legal[player][row][col]) {
+            cache->legal[player][row][col] = legal;
+            cache->count[player] += legal ? 1 : -1;
+        }
+    }
+}
+
+/* Brings the cache up to date after a move was played or taken back. Whether an empty cell is legal only depends on the discs
+   along its 8 lines up to the next empty cell, so only the first empty cell in each direction from a changed cell can change. */
+void updateMoveCache(Board* board, MoveCache* cache, const JournalMove* move) {
+    int changed, cell, i, d, k;
+    
+    if (move->pos.row < 0) {
+        return; /* A pass changes nothing. */
+    }
+    refreshMoveCache(board, cache, move->pos.row, move->pos.col);
+    
+    /* The played cell first, then the cells flipped along each ray. */
+    for (i = -1; i < 8; i++) {
+        changed = CELL(move->pos.row, move->pos.col);
+        for (k = 0; k < (i < 0 ? 1 : move->rays[i]); k++) {
+            if (i >= 0) {
+                changed += directionSteps[i];
+            }
+            for (d = 0; d < 8; d++) {
+                cell = changed + directionSteps[d];
+                while (board->cells[cell] == COMPUTER || board->cells[cell] == USER) {
+                    cell += directionSteps[d];
+                }
+                if (board->cells[cell] == EMPTY) {
+                    refreshMoveCache(board, cache, cell / BOARD_STRIDE - 1, cell % BOARD_STRIDE - 1);
+                }
+            }
+        }
+    }
+}
+
+/* Looks config->depth moves ahead for player, or solves the game exactly near the end.
+   (WITH DEPTH 0 IT ALWAYS CHOOSES THE MOVE WITH THE BIGGEST NUMBER OF FLIPS.)  */
+Position getComputerMove(Board* board, CellState player, const EngineConfig* config) {
+    int size = board->size;
     Move bestMove;
     int i, j;
     Position pos;
     int score;
+    long long nodes;
+    double winRate, deadline;
+    Line pv;
+    
+    /* The first moves come from the book if it knows the position. */
+    if (bookMove(board, player, &pos)) {
+        return pos;
+    }
+    
+    /* The time limit covers the endgame solver and the midgame search together. */
+    deadline = config->timeLimit > 0 ? wallClock() + config->timeLimit : 0;
+    
+    /* Close to the end the whole rest of the game is searched, so the computer never misplays it. */
+    if (countEmpties(board) <= config->endgameEmpties) {
+        pos = solveEndgame(board, player, config, deadline, &score, &pv);
+        if (isValidPosition(size, pos)) {
+            return pos;
+        }
+    }
+    
+    /* The Monte Carlo engine needs no evaluation, which is what the big boards lack. */
+    if (config->playouts > 0 && config->tree) {
+        pos = searchMcts(board, player, config, &winRate);
+        if (isValidPosition(size, pos)) {
+            return pos;
+        }
+    }
+    
+    if (config->depth > 0) {
+        pos = searchMidgame(board, player, config, deadline, &score, NULL, &nodes);
+        if (isValidPosition(size, pos)) {
+            return pos;
+        }
+    }
     
     /* assign a default move. */
     bestMove.pos.row = -1;
@@ -453,9 +1111,9 @@ Position getComputerMove(CellState** board, int size) {
             pos.col = j;
             
             /* If it's valid. */
-            if (isValidMove(board, size, pos, COMPUTER)) {
+            if (isValidMove(board, pos, player)) {
                 /* Compute the amount of flips. */
-                score = countFlips(board, size, pos, COMPUTER);
+                score = countFlips(board, pos, player);
                 
                 /* If it's better than the previous than this is the best move. */
                 if (score > bestMove.score) {
@@ -470,7 +1128,8 @@ Position getComputerMove(CellState** board, int size) {
 }
 
 /* Checks if the computer has a valid move or not. */
-bool hasValidMoves(CellState** board, int size, CellState player) {
+bool hasValidMoves(Board* board, CellState player) {
+    int size = board->size;
     int i, j;
     Position pos;
     
@@ -481,7 +1140,7 @@ bool hasValidMoves(CellState** board, int size, CellState player) {
             pos.col = j;
             
             /* If there is even one single valid move, return 1;  */
-            if (isValidMove(board, size, pos, player)) {
+            if (isValidMove(board, pos, player)) {
                 return true;
             }
         }
@@ -491,24 +1150,196 @@ bool hasValidMoves(CellState** board, int size, CellState player) {
     return false;
 }
 
-/* Counts the amount of occupied cells. */
-void countCells(CellState** board, int size, int* computerCount, int* userCount) {
-    int i, j;
+/* Counts the amount of occupied cells. The whole flat board is compared VECTOR_BYTES cells at a time, the border never matches. */
+void countCells(Board* board, int* computerCount, int* userCount) {
+    ByteVector cells, computer, user;
+    int i;
+    
+    /* reset the counters before starting. A lane can count to 255, far more than the board has vectors. */
+    computer = (ByteVector){0};
+    user = (ByteVector){0};
+    
+    /* A true compare is -1 in every byte, so subtracting it counts. */
+    for (i = 0; i < BOARD_BYTES; i += VECTOR_BYTES) {
+        memcpy(&cells, &board->cells[i], VECTOR_BYTES);
+        computer -= (ByteVector)(cells == COMPUTER);
+        user -= (ByteVector)(cells == USER);
+    }
     
-    /* reset the counters before starting. */
     *computerCount = 0;
     *userCount = 0;
+    for (i = 0; i < VECTOR_BYTES; i++) {
+        *computerCount += computer[i];
+        *userCount += user[i];
+    }
+}
+
+/* Splits the board into the set of cells of each CellState. The bits past the end of the board count as wall. */
+void boardSets(Board* board, CellSet* sets) {
+    int i;
     
-    /* Checks every cell. */
-    for (i = 0; i < size; i++) {
-        for (j = 0; j < size; j++) {
-            if (board[i][j] == COMPUTER) {
-                (*computerCount)++; /* Increases computer if it's a 1.*/
-            } else if (board[i][j] == USER) {
-                (*userCount)++; /* Increases player if it's a 0. */
+    memset(sets, 0, 4 * sizeof(CellSet));
+    for (i = 0; i < BOARD_WORDS * 64; i++) {
+        if (i < BOARD_BYTES) {
+            sets[board->cells[i]].words[i / 64] |= 1ULL << (i % 64);
+        } else {
+            sets[WALL].words[i / 64] |= 1ULL << (i % 64);
+        }
+    }
+}
+
+/* Moves the first words words of a set along the board: cell i of the result is cell i + shift of the set,
+   cells shifted in from outside are not in it. */
+void shiftSet(const CellSet* set, int shift, int words, CellSet* result) {
+    int skip = (shift < 0 ? -shift : shift) / 64;
+    int bits = (shift < 0 ? -shift : shift) % 64;
+    int w;
+    
+    /* The steps to a neighbour stay within one word, which is the shift stability needs over and over. */
+    if (skip == 0 && bits != 0) {
+        if (shift > 0) {
+            for (w = 0; w < words - 1; w++) {
+                result->words[w] = (set->words[w] >> bits) | (set->words[w + 1] << (64 - bits));
+            }
+            result->words[words - 1] = set->words[words - 1] >> bits;
+        } else {
+            result->words[0] = set->words[0] << bits;
+            for (w = 1; w < words; w++) {
+                result->words[w] = (set->words[w] << bits) | (set->words[w - 1] >> (64 - bits));
+            }
+        }
+        return;
+    }
+    for (w = 0; w < words; w++) {
+        result->words[w] = 0;
+    }
+    if (shift >= 0) {
+        for (w = 0; w + skip < words; w++) {
+            result->words[w] = set->words[w + skip] >> bits;
+            if (bits && w + skip + 1 < words) {
+                result->words[w] |= set->words[w + skip + 1] << (64 - bits);
+            }
+        }
+    } else {
+        for (w = skip; w < words; w++) {
+            result->words[w] = set->words[w - skip] << bits;
+            if (bits && w > skip) {
+                result->words[w] |= set->words[w - skip - 1] >> (64 - bits);
+            }
+        }
+    }
+}
+
+/* Number of cells in a set. */
+int countSet(const CellSet* set) {
+    int count, w;
+    
+    count = 0;
+    for (w = 0; w < BOARD_WORDS; w++) {
+        count += __builtin_popcountll(set->words[w]);
+    }
+    return count;
+}
+
+/* Counts the discs nobody can ever flip. A disc is stable if along each of the 4 lines through it either the line is full,
+   or the next cell on one side is the wall or a stable disc of the same colour. Stability spreads from the corners and edges,
+   so the rule is applied until nothing changes. It misses a few stable discs but never counts an unstable one.
+   While all four corners are empty it does not even look, stable discs away from the corners are too rare to pay for the search. */
+void findStable(const CellSet* sets, int size, int* computerStable, int* userStable) {
+    const int axes[4] = {1, BOARD_STRIDE - 1, BOARD_STRIDE, BOARD_STRIDE + 1};
+    const int corners[4] = {CELL(0, 0), CELL(0, size - 1), CELL(size - 1, 0), CELL(size - 1, size - 1)};
+    CellSet open[4], held[4], stable[3];
+    CellSet ahead, behind, candidates;
+    unsigned long long bits;
+    bool changed;
+    int words, player, cell, next, a, w;
+    
+    *computerStable = 0;
+    *userStable = 0;
+    for (a = 0; a < 4; a++) {
+        if (!(sets[EMPTY].words[corners[a] / 64] >> (corners[a] % 64) & 1)) {
+            break;
+        }
+    }
+    if (a == 4) {
+        return;
+    }
+    
+    /* Only the words up to the bottom border hold any of the board. */
+    words = CELL(size, size) / 64 + 1;
+    
+    /* A line is open, not full, if it has an empty cell. Each line is walked from the first empty cell found on it. */
+    memset(open, 0, sizeof(open));
+    for (w = 0; w < words; w++) {
+        for (bits = sets[EMPTY].words[w]; bits; bits &= bits - 1) {
+            cell = w * 64 + __builtin_ctzll(bits);
+            for (a = 0; a < 4; a++) {
+                if (open[a].words[w] >> (cell % 64) & 1) {
+                    continue;
+                }
+                for (next = cell; !(sets[WALL].words[next / 64] >> (next % 64) & 1); next += axes[a]) {
+                    open[a].words[next / 64] |= 1ULL << (next % 64);
+                }
+                for (next = cell - axes[a]; !(sets[WALL].words[next / 64] >> (next % 64) & 1); next -= axes[a]) {
+                    open[a].words[next / 64] |= 1ULL << (next % 64);
+                }
             }
         }
     }
+    
+    /* Along each line a disc is held by a full line or by the wall, whatever else happens. */
+    for (a = 0; a < 4; a++) {
+        shiftSet(&sets[WALL], axes[a], words, &ahead);
+        shiftSet(&sets[WALL], -axes[a], words, &behind);
+        for (w = 0; w < words; w++) {
+            held[a].words[w] = ~open[a].words[w] | ahead.words[w] | behind.words[w];
+        }
+    }
+    
+    memset(stable, 0, sizeof(stable));
+    for (player = COMPUTER; player <= USER; player++) {
+        do {
+            changed = false;
+            for (w = 0; w < words; w++) {
+                candidates.words[w] = sets[player].words[w] & ~stable[player].words[w];
+            }
+            for (a = 0; a < 4; a++) {
+                shiftSet(&stable[player], axes[a], words, &ahead);
+                shiftSet(&stable[player], -axes[a], words, &behind);
+                for (w = 0; w < words; w++) {
+                    candidates.words[w] &= held[a].words[w] | ahead.words[w] | behind.words[w];
+                }
+            }
+            for (w = 0; w < words; w++) {
+                if (candidates.words[w]) {
+                    stable[player].words[w] |= candidates.words[w];
+                    changed = true;
+                }
+            }
+        } while (changed);
+    }
+    
+    *computerStable = countSet(&stable[COMPUTER]);
+    *userStable = countSet(&stable[USER]);
+}
+
+/* Stable discs of both players on a game board. */
+void stableDiscs(Board* board, int* computerStable, int* userStable) {
+    CellSet sets[4];
+    
+    boardSets(board, sets);
+    findStable(sets, board->size, computerStable, userStable);
+}
+
+/* Shows the score so far and, from the stable discs, the least and the most the computer can still end the game with. */
+void printScoreBounds(Board* board) {
+    int computerCount, userCount, computerStable, userStable;
+    
+    countCells(board, &computerCount, &userCount);
+    stableDiscs(board, &computerStable, &userStable);
+    printf("Score: X %d, O %d. Stable: X %d, O %d, so the computer ends with %d to %d discs and you with %d to %d.\n",
+           computerCount, userCount, computerStable, userStable,
+           computerStable, board->size * board->size - userStable, userStable, board->size * board->size - computerStable);
 }
 
 /* Prints the result info. */
@@ -528,3 +1359,3352 @@ void printGameResult(int computerCount, int userCount) {
         printf("\nIt's a tie!\n"); /* Tıe if they are equal.*/
     }
 }
+
+/* Reads the command line options: -d for the search depth, -e for the endgame depth, -t for the thread count,
+   -l for the seconds a move may take, -m to search with that many Monte Carlo playouts per move instead, in a tree of at most -a megabytes.
+   Instead of playing, -b measures the search speed, -g writes self-play games of size -s with openings from seed -S to a file, -T trains the pattern weights on such a file,
+   -B builds the opening book of size -s from every position up to the given number of moves
+   -M plays a tournament between two engines on -t threads, with openings from seed -S,
+   -A analyzes every position of a file on -t threads, -I imports game records into a database and -Q looks positions up in one. */
+bool parseArguments(int argc, char* argv[], EngineConfig* config, ProgramOptions* options) {
+    EngineConfig check;
+    bool depthGiven = false;
+    int i;
+    
+    /* Default settings. */
+    config->depth = DEFAULT_DEPTH;
+    config->endgameEmpties = ENDGAME_DEFAULT_EMPTIES;
+    config->threads = 1;
+    config->playouts = 0;
+    config->timeLimit = 0;
+    config->table = NULL;
+    config->tree = NULL;
+    options->mode = MODE_PLAY;
+    options->size = 8;
+    options->count = 0;
+    options->fileName = NULL;
+    options->databaseName = NULL;
+    options->engineSpecs[0] = NULL;
+    options->engineSpecs[1] = NULL;
+    options->seed = (unsigned long long)time(NULL);
+    options->treeMemory = 0;
+    
+    for (i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "-d") == 0 && i + 1 < argc) {
+            depthGiven = true;
+            config->depth = atoi(argv[++i]);
+            if (config->depth < 0 || config->depth > MAX_DEPTH) {
+                printf("The search depth must be between 0 and %d.\n", MAX_DEPTH);
+                return false;
+            }
+        } else if (strcmp(argv[i], "-e") == 0 && i + 1 < argc) {
+            config->endgameEmpties = atoi(argv[++i]);
+            if (config->endgameEmpties < 0 || config->endgameEmpties > ENDGAME_MAX_EMPTIES) {
+                printf("The endgame depth must be between 0 and %d.\n", ENDGAME_MAX_EMPTIES);
+                return false;
+            }
+        } else if (strcmp(argv[i], "-t") == 0 && i + 1 < argc) {
+            config->threads = atoi(argv[++i]);
+            if (config->threads < 1 || config->threads > MAX_THREADS) {
+                printf("The thread count must be between 1 and %d.\n", MAX_THREADS);
+                return false;
+            }
+        } else if (strcmp(argv[i], "-m") == 0 && i + 1 < argc) {
+            config->playouts = atoi(argv[++i]);
+            if (config->playouts < 1) {
+                printf("The playout count must be at least 1.\n");
+                return false;
+            }
+        } else if (strcmp(argv[i], "-a") == 0 && i + 1 < argc) {
+            options->treeMemory = atoi(argv[++i]);
+            if (options->treeMemory < 1) {
+                printf("The tree needs at least 1 MB.\n");
+                return false;
+            }
+        } else if (strcmp(argv[i], "-l") == 0 && i + 1 < argc) {
+            config->timeLimit = atof(argv[++i]);
+            if (config->timeLimit <= 0) {
+                printf("The time limit must be a positive number of seconds.\n");
+                return false;
+            }
+        } else if (strcmp(argv[i], "-A") == 0 && i + 1 < argc) {
+            options->mode = MODE_ANALYZE;
+            options->fileName = argv[++i];
+        } else if (strcmp(argv[i], "-I") == 0 && i + 2 < argc) {
+            options->mode = MODE_IMPORT;
+            options->fileName = argv[++i];
+            options->databaseName = argv[++i];
+        } else if (strcmp(argv[i], "-Q") == 0 && i + 2 < argc) {
+            options->mode = MODE_QUERY;
+            options->databaseName = argv[++i];
+            options->fileName = argv[++i];
+        } else if (strcmp(argv[i], "-b") == 0) {
+            options->mode = MODE_BENCHMARK;
+        } else if (strcmp(argv[i], "-s") == 0 && i + 1 < argc) {
+            options->size = atoi(argv[++i]);
+            if (options->size < 4 || options->size > MAX_SIZE || options->size % 2 != 0) {
+                printf("Board size must be even and between 4 and %d.\n", MAX_SIZE);
+                return false;
+            }
+        } else if (strcmp(argv[i], "-S") == 0 && i + 1 < argc) {
+            options->seed = strtoull(argv[++i], NULL, 10);
+        } else if (strcmp(argv[i], "-g") == 0 && i + 2 < argc) {
+            options->mode = MODE_GENERATE;
+            options->count = atoi(argv[++i]);
+            options->fileName = argv[++i];
+        } else if (strcmp(argv[i], "-T") == 0 && i + 1 < argc) {
+            options->mode = MODE_TRAIN;
+            options->fileName = argv[++i];
+        } else if (strcmp(argv[i], "-B") == 0 && i + 1 < argc) {
+            options->mode = MODE_BOOK;
+            options->count = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "-M") == 0 && i + 3 < argc) {
+            options->mode = MODE_TOURNAMENT;
+            options->count = atoi(argv[++i]);
+            options->engineSpecs[0] = argv[++i];
+            options->engineSpecs[1] = argv[++i];
+            if (options->count < 1 || !parseEngine(options->engineSpecs[0], &check) || !parseEngine(options->engineSpecs[1], &check)) {
+                printf("A tournament needs a game count and two engines written as depth/endgame_empties, for example 4/14,\n"
+                       "or as mplayouts/endgame_empties for Monte Carlo tree search, for example m20000/14.\n");
+                return false;
+            }
+        } else {
+            printf("Usage: %s [-d depth] [-l seconds] [-m playouts [-a megabytes]] [-e endgame_empties] [-t threads]\n"
+                   "       [-b | -g games file [-s size] [-S seed] | -T file | -B moves [-s size] | -M games engine engine [-s size] [-S seed] [-a megabytes]\n"
+                   "       | -A file [-s size] | -I records database | -Q database positions]\n", argv[0]);
+            return false;
+        }
+    }
+    
+    /* With a time limit the search deepens until the time is up, unless a depth was given too. */
+    if (config->timeLimit > 0 && !depthGiven) {
+        config->depth = MAX_DEPTH;
+    }
+    /* Depth 0 just takes the most flips, which gives no score to report for a position the endgame solver does not reach. */
+    if (options->mode == MODE_ANALYZE && config->depth < 1) {
+        printf("Analysis needs a search depth of at least 1.\n");
+        return false;
+    }
+    return true;
+}
+
+/* Counts the cells nobody has played yet. */
+int countEmpties(Board* board) {
+    int computerCount, userCount;
+    
+    countCells(board, &computerCount, &userCount);
+    return board->size * board->size - computerCount - userCount;
+}
+
+/* The other player. */
+CellState opponentOf(CellState player) {
+    if (player == USER) {
+        return COMPUTER;
+    }
+    return USER;
+}
+
+/* Small seedable random number generator (splitmix64), so hash keys and test openings are the same on every run. */
+unsigned long long nextRandom(unsigned long long* state) {
+    unsigned long long z;
+    
+    *state += 0x9E3779B97F4A7C15ULL;
+    z = *state;
+    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+    z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+    return z ^ (z >> 31);
+}
+
+/* Fills the hashing keys. */
+void initZobrist(void) {
+    unsigned long long seed = 20240229ULL;
+    int i;
+    
+    for (i = 0; i < MAX_CELLS; i++) {
+        zobristCells[i][EMPTY] = 0;
+        zobristCells[i][COMPUTER] = nextRandom(&seed);
+        zobristCells[i][USER] = nextRandom(&seed);
+    }
+    for (i = 0; i <= MAX_SIZE; i++) {
+        zobristSizes[i] = nextRandom(&seed);
+    }
+    zobristSide = nextRandom(&seed);
+}
+
+/* Allocates a transposition table with 2^bits entries. */
+bool initTable(TranspositionTable* table, int bits) {
+    table->entries = (TableEntry*)calloc((size_t)1 << bits, sizeof(TableEntry));
+    if (!table->entries) {
+        return false;
+    }
+    table->mask = ((unsigned long long)1 << bits) - 1;
+    return true;
+}
+
+/* Forgets everything in the table. */
+void clearTable(TranspositionTable* table) {
+    memset(table->entries, 0, (size_t)(table->mask + 1) * sizeof(TableEntry));
+}
+
+/* Releases the table. */
+void freeTable(TranspositionTable* table) {
+    free(table->entries);
+    table->entries = NULL;
+}
+
+/* Looks a position up. The data word packs the score (32 bits), the depth (8 bits), the bound type (2 bits) and the best move (10 bits). */
+bool probeTable(TranspositionTable* table, unsigned long long key, int* depth, int* bound, int* score, int* move) {
+    TableEntry* entry = &table->entries[key & table->mask];
+    unsigned long long check, data;
+    
+    check = atomic_load_explicit(&entry->check, memory_order_relaxed);
+    data = atomic_load_explicit(&entry->data, memory_order_relaxed);
+    if ((check ^ data) != key || data == 0) {
+        return false;
+    }
+    *score = (int)(unsigned int)(data & 0xFFFFFFFFULL);
+    *depth = (int)((data >> 32) & 0xFF);
+    *bound = (int)((data >> 40) & 0x3);
+    *move = (int)((data >> 42) & 0x3FF);
+    return true;
+}
+
+/* Stores a search result, replacing whatever was in the slot. No lock is taken: a torn entry simply fails the check in probeTable. */
+void storeTable(TranspositionTable* table, unsigned long long key, int depth, int bound, int score, int move) {
+    TableEntry* entry = &table->entries[key & table->mask];
+    unsigned long long data;
+    
+    data = (unsigned long long)(unsigned int)score
+         | (unsigned long long)depth << 32
+         | (unsigned long long)bound << 40
+         | (unsigned long long)move << 42;
+    atomic_store_explicit(&entry->check, key ^ data, memory_order_relaxed);
+    atomic_store_explicit(&entry->data, data, memory_order_relaxed);
+}
+
+/* Copies the board for a search thread and collects the empty cells. */
+void initSearch(SearchState* state, Board* board) {
+    int size = board->size;
+    Position pos;
+    int edgeRow, edgeCol;
+    int i, j;
+    
+    state->board = *board;
+    boardSets(board, state->sets);
+    state->discs[EMPTY] = 0;
+    state->discs[COMPUTER] = 0;
+    state->discs[USER] = 0;
+    state->emptyCount = 0;
+    state->parity = 0;
+    state->hash = zobristSizes[size];
+    state->journal.count = 0;
+    state->nodes = 0;
+    state->patterns = NULL;
+    state->table = NULL;
+    state->deadline = 0;
+    state->aborted = false;
+    state->outOfTime = false;
+    state->pool = NULL;
+    state->split = NULL;
+    state->pv[0].length = 0;
+    
+    for (i = 0; i < size; i++) {
+        for (j = 0; j < size; j++) {
+            state->discs[board->cells[CELL(i, j)]]++;
+            state->hash ^= zobristCells[i * MAX_SIZE + j][board->cells[CELL(i, j)]];
+            if (board->cells[CELL(i, j)] == EMPTY) {
+                pos.row = i;
+                pos.col = j;
+                state->empties[state->emptyCount++] = pos;
+                state->parity ^= 1 << quarterOf(state, pos);
+            }
+            
+            /* Corners are never lost, the cells next to them give them away, edges are safer than the middle. */
+            edgeRow = (i == 0 || i == size - 1);
+            edgeCol = (j == 0 || j == size - 1);
+            if (edgeRow && edgeCol) {
+                state->weights[i][j] = 25;
+            } else if ((i == 1 || i == size - 2) && (j == 1 || j == size - 2)) {
+                state->weights[i][j] = -8;
+            } else if ((edgeRow && (j == 1 || j == size - 2)) || (edgeCol && (i == 1 || i == size - 2))) {
+                state->weights[i][j] = -4;
+            } else if (edgeRow || edgeCol) {
+                state->weights[i][j] = 3;
+            } else {
+                state->weights[i][j] = 1;
+            }
+        }
+    }
+    
+    if (patterns && patterns->size == size) {
+        state->patterns = patterns;
+        computePatternIndices(patterns, &state->board, state->patternIndex);
+    }
+    computeMoveCache(&state->board, &state->legalMoves);
+    state->cacheMoves = true;
+}
+
+/* Which quarter of the board a cell is in, the parity of the empties is tracked per quarter. */
+int quarterOf(const SearchState* state, Position pos) {
+    int half = state->board.size / 2;
+    
+    return (pos.row >= half) * 2 + (pos.col >= half);
+}
+
+/* Plays a move on the search's board through the journal and keeps the counters, the hash and the patterns in step.
+   Returns the number of flips, 0 if the move is illegal. */
+int searchPlay(SearchState* state, Position pos, CellState player) {
+    CellState opponent = opponentOf(player);
+    int flips;
+    
+    flips = playMove(&state->board, &state->journal, pos, player);
+    if (flips == 0) {
+        return 0;
+    }
+    searchUpdateFlips(state, &state->journal.moves[state->journal.count - 1], 1);
+    if (state->cacheMoves) {
+        updateMoveCache(&state->board, &state->legalMoves, &state->journal.moves[state->journal.count - 1]);
+    }
+    state->hash ^= zobristCells[pos.row * MAX_SIZE + pos.col][player];
+    toggleCell(state->sets, CELL(pos.row, pos.col), EMPTY, player);
+    if (state->patterns) {
+        updatePatterns(state, pos, player);
+    }
+    state->discs[player] += flips + 1;
+    state->discs[opponent] -= flips;
+    state->discs[EMPTY]--;
+    state->parity ^= 1 << quarterOf(state, pos);
+    state->nodes++;
+    return flips;
+}
+
+/* Takes back the last move played with searchPlay. */
+void searchUndo(SearchState* state) {
+    JournalMove move;
+    CellState opponent;
+    int flips, i;
+    
+    move = state->journal.moves[state->journal.count - 1];
+    opponent = opponentOf(move.player);
+    searchUpdateFlips(state, &move, -1);
+    undoMove(&state->board, &state->journal, NULL);
+    if (state->cacheMoves) {
+        updateMoveCache(&state->board, &state->legalMoves, &move);
+    }
+    
+    flips = 0;
+    for (i = 0; i < 8; i++) {
+        flips += move.rays[i];
+    }
+    state->hash ^= zobristCells[move.pos.row * MAX_SIZE + move.pos.col][move.player];
+    toggleCell(state->sets, CELL(move.pos.row, move.pos.col), EMPTY, move.player);
+    if (state->patterns) {
+        updatePatterns(state, move.pos, -(int)move.player);
+    }
+    state->discs[move.player] -= flips + 1;
+    state->discs[opponent] += flips;
+    state->discs[EMPTY]++;
+    state->parity ^= 1 << quarterOf(state, move.pos);
+}
+
+/* Walks the cells a journal move flipped and updates the hash, the cell sets and the pattern indices: sign 1 after playing it, -1 before taking it back. */
+void searchUpdateFlips(SearchState* state, const JournalMove* move, int sign) {
+    CellState player = move->player;
+    CellState opponent = opponentOf(player);
+    Position cell;
+    int i, k;
+    
+    for (i = 0; i < 8; i++) {
+        cell = move->pos;
+        for (k = 0; k < move->rays[i]; k++) {
+            cell.row += directions[i][0];
+            cell.col += directions[i][1];
+            state->hash ^= zobristCells[cell.row * MAX_SIZE + cell.col][opponent] ^ zobristCells[cell.row * MAX_SIZE + cell.col][player];
+            toggleCell(state->sets, CELL(cell.row, cell.col), opponent, player);
+            if (state->patterns) {
+                updatePatterns(state, cell, sign * (player - opponent));
+            }
+        }
+    }
+}
+
+/* Moves a cell between two of a board's cell sets. The same call undoes it. */
+void toggleCell(CellSet* sets, int cell, CellState from, CellState to) {
+    unsigned long long bit = 1ULL << (cell % 64);
+    
+    sets[from].words[cell / 64] ^= bit;
+    sets[to].words[cell / 64] ^= bit;
+}
+
+/* Stable discs of player and of the opponent in the search's position. */
+void searchStable(SearchState* state, CellState player, int* playerStable, int* opponentStable) {
+    int computerStable, userStable;
+    
+    findStable(state->sets, state->board.size, &computerStable, &userStable);
+    *playerStable = player == COMPUTER ? computerStable : userStable;
+    *opponentStable = player == COMPUTER ? userStable : computerStable;
+}
+
+/* Number of legal moves player has, straight from the cache if it is kept. */
+int searchMobility(SearchState* state, CellState player) {
+    Position pos;
+    int count, i;
+    
+    if (state->cacheMoves) {
+        return state->legalMoves.count[player];
+    }
+    count = 0;
+    for (i = 0; i < state->emptyCount; i++) {
+        pos = state->empties[i];
+        if (state->board.cells[CELL(pos.row, pos.col)] == EMPTY && countFlips(&state->board, pos, player) > 0) {
+            count++;
+        }
+    }
+    return count;
+}
+
+/* Whether player may play at an empty cell. */
+bool searchIsLegal(SearchState* state, Position pos, CellState player) {
+    if (state->cacheMoves) {
+        return state->legalMoves.legal[player][pos.row][pos.col];
+    }
+    return countFlips(&state->board, pos, player) > 0;
+}
+
+/* Whether the search must unwind: the deadline passed, or a split point it works under was cut off. The clock is only read every 4096 nodes.
+   Once the answer is yes it stays yes, until the split point that was cut off takes its owner back. */
+bool searchStopped(SearchState* state) {
+    if (!state->aborted && state->deadline > 0 && (state->nodes & 4095) == 0 && wallClock() > state->deadline) {
+        state->outOfTime = true;
+        state->aborted = true;
+    }
+    if (!state->aborted && state->split && splitCutOff(state->split)) {
+        state->aborted = true;
+    }
+    return state->aborted;
+}
+
+/* A move that raised alpha: the line of its node becomes the move followed by the best line after it. Call it after the move is taken back. */
+void updateLine(SearchState* state, Position move) {
+    int ply = state->journal.count;
+    Line* line = &state->pv[ply];
+    Line* next = &state->pv[ply + 1];
+    int i;
+    
+    line->moves[0] = move;
+    for (i = 0; i < next->length && i + 1 < MAX_PLY; i++) {
+        line->moves[i + 1] = next->moves[i];
+    }
+    line->length = i + 1;
+}
+
+/* A pass does not show in the journal, so the opponent's line is at the same ply. The pass goes in front of it,
+   unless the opponent cannot move either: then the game ended and there was no pass. */
+void addPassToLine(SearchState* state, CellState opponent) {
+    Line* line = &state->pv[state->journal.count];
+    int i;
+    
+    if (!hasValidMoves(&state->board, opponent)) {
+        return;
+    }
+    if (line->length == MAX_PLY) {
+        line->length--;
+    }
+    for (i = line->length; i > 0; i--) {
+        line->moves[i] = line->moves[i - 1];
+    }
+    line->moves[0].row = -1;
+    line->moves[0].col = -1;
+    line->length++;
+}
+
+/* Searches the root moves on config->threads threads. The first move is searched alone to get a good bound, then the other
+   root moves become a split point. Below the root any node splits the same way once its eldest move is searched and a helper is idle
+   (Young Brothers Wait), so the threads share the subtrees of the root moves too, not only the root moves themselves.
+   Returns the best score and move, and the line it starts. A search the deadline stopped returns no move. */
+int searchRoot(Board* board, CellState player, Position* moves, int moveCount, int depth, const EngineConfig* config, double deadline,
+               Position* bestPos, Line* pv, long long* nodes) {
+    SearchState* state;
+    SearchPool pool;
+    pthread_t threads[MAX_THREADS];
+    int started, best, bestMove, i;
+    bool aborted;
+    
+    bestPos->row = -1;
+    bestPos->col = -1;
+    pv->length = 0;
+    *nodes = 0;
+    
+    /* The search state is too big for the stack of a thread, so it lives on the heap. */
+    state = (SearchState*)malloc(sizeof(SearchState));
+    if (!state) {
+        return -SCORE_INFINITY;
+    }
+    initSearch(state, board);
+    state->table = config->table;
+    state->cacheMoves = depth >= 0;
+    state->deadline = deadline;
+    
+    pool.table = config->table;
+    pool.deadline = deadline;
+    pool.open = NULL;
+    pool.done = false;
+    atomic_init(&pool.idle, 0);
+    atomic_init(&pool.nodes, 0);
+    pthread_mutex_init(&pool.lock, NULL);
+    pthread_cond_init(&pool.wake, NULL);
+    pthread_cond_init(&pool.finished, NULL);
+    state->pool = &pool;
+    
+    /* This thread owns the root, the others help. Without helpers the root split is searched by this thread alone. */
+    started = 0;
+    for (i = 1; i < config->threads; i++) {
+        if (pthread_create(&threads[started], NULL, searchHelper, &pool) == 0) {
+            started++;
+        }
+    }
+    
+    searchPlay(state, moves[0], player);
+    if (depth < 0) {
+        best = -solveNode(state, opponentOf(player), -SCORE_INFINITY, SCORE_INFINITY, false);
+    } else {
+        best = -searchNode(state, opponentOf(player), depth, -SCORE_INFINITY, SCORE_INFINITY, false);
+    }
+    searchUndo(state);
+    updateLine(state, moves[0]);
+    bestMove = moves[0].row * MAX_SIZE + moves[0].col;
+    if (!state->aborted && moveCount > 1) {
+        searchSplit(state, player, moves + 1, moveCount - 1, depth, -SCORE_INFINITY, SCORE_INFINITY, &best, &bestMove);
+    }
+    
+    pthread_mutex_lock(&pool.lock);
+    pool.done = true;
+    pthread_cond_broadcast(&pool.wake);
+    pthread_mutex_unlock(&pool.lock);
+    for (i = 0; i < started; i++) {
+        pthread_join(threads[i], NULL);
+    }
+    pthread_cond_destroy(&pool.finished);
+    pthread_cond_destroy(&pool.wake);
+    pthread_mutex_destroy(&pool.lock);
+    
+    *nodes = state->nodes + atomic_load(&pool.nodes);
+    aborted = state->aborted;
+    if (!aborted) {
+        bestPos->row = bestMove / MAX_SIZE;
+        bestPos->col = bestMove % MAX_SIZE;
+        *pv = state->pv[0];
+    }
+    free(state);
+    return aborted ? -SCORE_INFINITY : best;
+}
+
+/* Whether a node may split: only if a helper is waiting for work, otherwise opening a split point is wasted effort. */
+bool helperIdle(SearchState* state) {
+    return state->pool && atomic_load(&state->pool->idle) > 0;
+}
+
+/* Whether a split point the search is working under, or any split point above it, was cut off. */
+bool splitCutOff(const SplitPoint* split) {
+    for (; split; split = split->parent) {
+        if (atomic_load(&split->cutoff)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+/* Searches the younger moves of a node together with any helpers that join. The state must be at the node, best and bestMove
+   come in as the eldest move's result and go out as the node's (bestMove may be NULL), and the node's line ends up in the state's pv.
+   Returns once every helper has left, with the state aborted only if the deadline passed or a split point above was cut off. */
+void searchSplit(SearchState* state, CellState player, const Position* moves, int moveCount, int depth, int alpha, int beta,
+                 int* best, int* bestMove) {
+    SearchPool* pool = state->pool;
+    SplitPoint split;
+    SplitPoint** link;
+    int ply = state->journal.count;
+    
+    split.board = state->board;
+    split.player = player;
+    split.moves = moves;
+    split.moveCount = moveCount;
+    split.depth = depth;
+    split.cacheMoves = state->cacheMoves;
+    split.beta = beta;
+    atomic_init(&split.next, 0);
+    atomic_init(&split.alpha, *best > alpha ? *best : alpha);
+    atomic_init(&split.cutoff, false);
+    split.best = *best;
+    split.bestMove = bestMove ? *bestMove : -1;
+    split.pv = state->pv[ply];
+    split.helpers = 0;
+    split.outOfTime = false;
+    split.parent = state->split;
+    
+    pthread_mutex_lock(&pool->lock);
+    split.nextOpen = pool->open;
+    pool->open = &split;
+    pthread_cond_broadcast(&pool->wake);
+    pthread_mutex_unlock(&pool->lock);
+    
+    state->split = &split;
+    searchSplitMoves(state, &split);
+    
+    /* Once the owner runs out of moves nobody may join, the helpers still searching are waited for. */
+    pthread_mutex_lock(&pool->lock);
+    link = &pool->open;
+    while (*link != &split) {
+        link = &(*link)->nextOpen;
+    }
+    *link = split.nextOpen;
+    while (split.helpers > 0) {
+        pthread_cond_wait(&pool->finished, &pool->lock);
+    }
+    pthread_mutex_unlock(&pool->lock);
+    
+    /* A cutoff here only stopped the moves of this node, the search above it goes on. */
+    state->split = split.parent;
+    state->outOfTime = state->outOfTime || split.outOfTime;
+    state->aborted = state->outOfTime || splitCutOff(split.parent);
+    *best = split.best;
+    if (bestMove) {
+        *bestMove = split.bestMove;
+    }
+    state->pv[ply] = split.pv;
+}
+
+/* Takes moves of a split point until none are left, one reaches beta or the search stops, and records those that beat the best so far.
+   The state must be at the split point's position. */
+void searchSplitMoves(SearchState* state, SplitPoint* split) {
+    CellState opponent = opponentOf(split->player);
+    Position pos;
+    int index, alpha, value;
+    
+    while ((index = atomic_fetch_add(&split->next, 1)) < split->moveCount) {
+        /* A score above alpha is all that matters, so the window starts at the best score any thread has found. */
+        alpha = atomic_load(&split->alpha);
+        if (alpha >= split->beta) {
+            break;
+        }
+        pos = split->moves[index];
+        searchPlay(state, pos, split->player);
+        if (split->depth < 0) {
+            value = -solveNode(state, opponent, -split->beta, -alpha, false);
+        } else {
+            value = -searchNode(state, opponent, split->depth, -split->beta, -alpha, false);
+        }
+        searchUndo(state);
+        if (state->aborted) {
+            break;
+        }
+        
+        pthread_mutex_lock(&state->pool->lock);
+        if (value > split->best) {
+            split->best = value;
+            split->bestMove = pos.row * MAX_SIZE + pos.col;
+            if (value > atomic_load(&split->alpha)) {
+                updateLine(state, pos);
+                split->pv = state->pv[state->journal.count];
+                if (value >= split->beta) {
+                    atomic_store(&split->cutoff, true);
+                }
+                atomic_store(&split->alpha, value);
+            }
+        }
+        pthread_mutex_unlock(&state->pool->lock);
+    }
+}
+
+/* A helper thread waits for split points to open and searches their moves, until the search is over. */
+void* searchHelper(void* arg) {
+    SearchPool* pool = (SearchPool*)arg;
+    SearchState* state;
+    SplitPoint* split;
+    
+    /* A helper without a search state never joins, the others do its share. */
+    state = (SearchState*)malloc(sizeof(SearchState));
+    if (!state) {
+        return NULL;
+    }
+    
+    pthread_mutex_lock(&pool->lock);
+    while (!pool->done) {
+        split = pool->open;
+        while (split && (atomic_load(&split->cutoff) || atomic_load(&split->next) >= split->moveCount)) {
+            split = split->nextOpen;
+        }
+        if (!split) {
+            atomic_fetch_add(&pool->idle, 1);
+            pthread_cond_wait(&pool->wake, &pool->lock);
+            atomic_fetch_sub(&pool->idle, 1);
+            continue;
+        }
+        split->helpers++;
+        pthread_mutex_unlock(&pool->lock);
+        
+        initSearch(state, &split->board);
+        state->table = pool->table;
+        state->cacheMoves = split->cacheMoves;
+        state->deadline = pool->deadline;
+        state->pool = pool;
+        state->split = split;
+        searchSplitMoves(state, split);
+        atomic_fetch_add(&pool->nodes, state->nodes);
+        
+        pthread_mutex_lock(&pool->lock);
+        split->outOfTime = split->outOfTime || state->outOfTime;
+        split->helpers--;
+        if (split->helpers == 0) {
+            pthread_cond_broadcast(&pool->finished);
+        }
+    }
+    pthread_mutex_unlock(&pool->lock);
+    free(state);
+    return NULL;
+}
+
+/* Finds the move that ends the game with the biggest disc difference for player, assuming perfect play by both sides,
+   and the line both sides play. Gives up with no move once the deadline passes, 0 for none. */
+Position solveEndgame(Board* board, CellState player, const EngineConfig* config, double deadline, int* score, Line* pv) {
+    SearchState* state;
+    Position moves[MAX_CELLS];
+    Position bestPos;
+    int moveCount;
+    long long nodes;
+    
+    bestPos.row = -1;
+    bestPos.col = -1;
+    *score = -SCORE_INFINITY;
+    pv->length = 0;
+    
+    state = (SearchState*)malloc(sizeof(SearchState));
+    if (!state) {
+        return bestPos;
+    }
+    initSearch(state, board);
+    moveCount = orderEndgameMoves(state, player, moves);
+    free(state);
+    if (moveCount == 0) {
+        return bestPos;
+    }
+    
+    *score = searchRoot(board, player, moves, moveCount, -1, config, deadline, &bestPos, pv, &nodes);
+    return bestPos;
+}
+
+/* Collects the legal moves in the order they should be searched and returns how many there are.
+   Deep in the tree moves that leave the opponent the fewest replies go first (fastest-first),
+   close to the end moves in quarters with an odd number of empties go first, since playing last in a region is an advantage. */
+int orderEndgameMoves(SearchState* state, CellState player, Position* moves) {
+    int keys[MAX_CELLS];
+    int empties, count, flips, key, i, j;
+    Position pos;
+    
+    empties = state->discs[EMPTY];
+    count = 0;
+    for (i = 0; i < state->emptyCount; i++) {
+        pos = state->empties[i];
+        if (state->board.cells[CELL(pos.row, pos.col)] != EMPTY) {
+            continue;
+        }
+        
+        /* Odd quarters first. */
+        key = (state->parity >> quarterOf(state, pos) & 1) ? 0 : 1;
+        if (empties > FASTEST_FIRST_EMPTIES) {
+            flips = searchPlay(state, pos, player);
+            if (flips == 0) {
+                continue;
+            }
+            key += 2 * searchMobility(state, opponentOf(player));
+            searchUndo(state);
+        } else if (!searchIsLegal(state, pos, player)) {
+            continue;
+        }
+        
+        /* Insertion sort, there are never many moves. */
+        for (j = count; j > 0 && keys[j - 1] > key; j--) {
+            keys[j] = keys[j - 1];
+            moves[j] = moves[j - 1];
+        }
+        keys[j] = key;
+        moves[j] = pos;
+        count++;
+    }
+    return count;
+}
+
+/* With a single empty cell left there is nothing to order, whoever can play there does. */
+int solveLastEmpty(SearchState* state, CellState player) {
+    CellState opponent = opponentOf(player);
+    Line* line;
+    Position pos;
+    int flips, score, i;
+    
+    pos = state->empties[0];
+    for (i = 0; i < state->emptyCount; i++) {
+        if (state->board.cells[CELL(state->empties[i].row, state->empties[i].col)] == EMPTY) {
+            pos = state->empties[i];
+            break;
+        }
+    }
+    state->nodes++;
+    
+    /* The line ends with the last move, after a pass if player cannot make it. */
+    score = state->discs[player] - state->discs[opponent];
+    line = &state->pv[state->journal.count];
+    line->moves[0] = pos;
+    line->length = 1;
+    flips = countFlips(&state->board, pos, player);
+    if (flips > 0) {
+        return score + 2 * flips + 1;
+    }
+    flips = countFlips(&state->board, pos, opponent);
+    if (flips > 0) {
+        addPassToLine(state, opponent);
+        return score - 2 * flips - 1;
+    }
+    line->length = 0;
+    return score;
+}
+
+/* Negamax alpha-beta over the rest of the game. The score is player's discs minus the opponent's when the game ends. */
+int solveNode(SearchState* state, CellState player, int alpha, int beta, bool passed) {
+    CellState opponent = opponentOf(player);
+    Position moves[ENDGAME_MAX_EMPTIES];
+    int moveCount, best, value, i;
+    int cells, playerStable, opponentStable;
+    
+    state->pv[state->journal.count].length = 0;
+    if (searchStopped(state)) {
+        return 0;
+    }
+    if (state->discs[EMPTY] == 0) {
+        return state->discs[player] - state->discs[opponent];
+    }
+    if (state->discs[EMPTY] == 1) {
+        return solveLastEmpty(state, player);
+    }
+    
+    /* The opponent keeps its stable discs, so player cannot win by more than the rest of the board, which may be no better than alpha.
+       Stable discs are never more than the discs on the board, so most nodes skip the work. The bound the other way is found
+       one move later, when the opponent is the one to move. */
+    cells = state->board.size * state->board.size;
+    if (state->discs[EMPTY] >= STABILITY_EMPTIES && cells - 2 * state->discs[opponent] <= alpha) {
+        searchStable(state, player, &playerStable, &opponentStable);
+        if (cells - 2 * opponentStable <= alpha) {
+            return cells - 2 * opponentStable;
+        }
+    }
+    
+    moveCount = orderEndgameMoves(state, player, moves);
+    if (moveCount == 0) {
+        /* Two passes in a row end the game. */
+        if (passed) {
+            return state->discs[player] - state->discs[opponent];
+        }
+        value = -solveNode(state, opponent, -beta, -alpha, true);
+        addPassToLine(state, opponent);
+        return value;
+    }
+    
+    best = -SCORE_INFINITY;
+    for (i = 0; i < moveCount; i++) {
+        if (i == 1 && state->discs[EMPTY] >= SPLIT_EMPTIES && helperIdle(state)) {
+            searchSplit(state, player, moves + 1, moveCount - 1, -1, alpha, beta, &best, NULL);
+            if (state->aborted) {
+                return 0;
+            }
+            break;
+        }
+        searchPlay(state, moves[i], player);
+        value = -solveNode(state, opponent, -beta, -alpha, false);
+        searchUndo(state);
+        if (state->aborted) {
+            return 0;
+        }
+        
+        if (value > best) {
+            best = value;
+            if (value > alpha) {
+                alpha = value;
+                updateLine(state, moves[i]);
+                if (alpha >= beta) {
+                    break; /* The opponent will never allow this line. */
+                }
+            }
+        }
+    }
+    return best;
+}
+
+/* Iterative deepening up to config->depth, or until the deadline if there is one (0 for none). Each iteration puts the previous best move first,
+   and the shared transposition table orders the moves below the root. The result is the last iteration that finished,
+   with its line if pv is not NULL. */
+Position searchMidgame(Board* board, CellState player, const EngineConfig* config, double deadline, int* score, Line* pv, long long* nodes) {
+    SearchState* state;
+    Position moves[MAX_CELLS];
+    Position bestPos, pos;
+    Line line;
+    int moveCount, depth, value, i;
+    long long iterationNodes;
+    
+    bestPos.row = -1;
+    bestPos.col = -1;
+    *score = -SCORE_INFINITY;
+    *nodes = 0;
+    if (pv) {
+        pv->length = 0;
+    }
+    
+    state = (SearchState*)malloc(sizeof(SearchState));
+    if (!state) {
+        return bestPos;
+    }
+    initSearch(state, board);
+    moveCount = orderMidgameMoves(state, player, moves, -1);
+    free(state);
+    if (moveCount == 0) {
+        return bestPos;
+    }
+    
+    for (depth = 1; depth <= config->depth; depth++) {
+        value = searchRoot(board, player, moves, moveCount, depth - 1, config, deadline, &pos, &line, &iterationNodes);
+        *nodes += iterationNodes;
+        if (!isValidPosition(board->size, pos)) {
+            break;
+        }
+        bestPos = pos;
+        *score = value;
+        if (pv) {
+            *pv = line;
+        }
+        
+        /* The best move so far is searched first next time. */
+        for (i = 0; i < moveCount; i++) {
+            if (moves[i].row == pos.row && moves[i].col == pos.col) {
+                break;
+            }
+        }
+        for (; i > 0; i--) {
+            moves[i] = moves[i - 1];
+        }
+        moves[0] = pos;
+    }
+    return bestPos;
+}
+
+/* Collects the legal moves, the table's best move first and then the most valuable cells. Returns how many there are. */
+int orderMidgameMoves(SearchState* state, CellState player, Position* moves, int hintMove) {
+    int keys[MAX_CELLS];
+    int count, key, i, j;
+    Position pos;
+    
+    count = 0;
+    for (i = 0; i < state->emptyCount; i++) {
+        pos = state->empties[i];
+        if (state->board.cells[CELL(pos.row, pos.col)] != EMPTY || !searchIsLegal(state, pos, player)) {
+            continue;
+        }
+        
+        key = -state->weights[pos.row][pos.col];
+        if (pos.row * MAX_SIZE + pos.col == hintMove) {
+            key = -SCORE_INFINITY;
+        }
+        for (j = count; j > 0 && keys[j - 1] > key; j--) {
+            keys[j] = keys[j - 1];
+            moves[j] = moves[j - 1];
+        }
+        keys[j] = key;
+        moves[j] = pos;
+        count++;
+    }
+    return count;
+}
+
+/* Static evaluation from player's point of view. With trained weights it is a sum of pattern table lookups,
+   otherwise cell values plus the differences in mobility and in stable discs. */
+int evaluatePosition(SearchState* state, CellState player) {
+    CellState opponent = opponentOf(player);
+    int playerStable, opponentStable;
+    int score, i, j;
+    
+    if (state->patterns) {
+        score = patternScore(state->patterns, state->patternIndex, patternPhase(state->board.size, state->discs[EMPTY]));
+        return player == COMPUTER ? score : -score;
+    }
+    
+    score = 0;
+    for (i = 0; i < state->board.size; i++) {
+        for (j = 0; j < state->board.size; j++) {
+            if (state->board.cells[CELL(i, j)] == player) {
+                score += state->weights[i][j];
+            } else if (state->board.cells[CELL(i, j)] == opponent) {
+                score -= state->weights[i][j];
+            }
+        }
+    }
+    score += MOBILITY_WEIGHT * (searchMobility(state, player) - searchMobility(state, opponent));
+    searchStable(state, player, &playerStable, &opponentStable);
+    score += STABILITY_WEIGHT * (playerStable - opponentStable);
+    return score;
+}
+
+/* Score of a finished game, any win beats any evaluation and bigger wins beat smaller ones. */
+int finalScore(const SearchState* state, CellState player) {
+    int diff = state->discs[player] - state->discs[opponentOf(player)];
+    
+    if (diff > 0) {
+        return WIN_SCORE + diff;
+    } else if (diff < 0) {
+        return -WIN_SCORE + diff;
+    }
+    return 0;
+}
+
+/* Negamax alpha-beta to a fixed depth with the shared transposition table. */
+int searchNode(SearchState* state, CellState player, int depth, int alpha, int beta, bool passed) {
+    CellState opponent = opponentOf(player);
+    Position moves[MAX_CELLS];
+    unsigned long long key;
+    int entryDepth, entryBound, entryScore, entryMove;
+    int originalAlpha, moveCount, best, bestMove, value, i;
+    int cells, playerStable, opponentStable;
+    
+    state->pv[state->journal.count].length = 0;
+    if (searchStopped(state)) {
+        return 0;
+    }
+    if (state->discs[EMPTY] == 0) {
+        return finalScore(state, player);
+    }
+    
+    /* Once one side has more than half the board stable the game is decided, at least by that margin. */
+    cells = state->board.size * state->board.size;
+    if (2 * state->discs[player] > cells || 2 * state->discs[opponent] > cells) {
+        searchStable(state, player, &playerStable, &opponentStable);
+        if (2 * playerStable > cells && WIN_SCORE + 2 * playerStable - cells >= beta) {
+            return WIN_SCORE + 2 * playerStable - cells;
+        }
+        if (2 * opponentStable > cells && -WIN_SCORE - (2 * opponentStable - cells) <= alpha) {
+            return -WIN_SCORE - (2 * opponentStable - cells);
+        }
+    }
+    if (depth == 0) {
+        return evaluatePosition(state, player);
+    }
+    
+    /* A result from an earlier search of the same position may settle it, or at least name the best move. */
+    key = state->hash ^ (player == USER ? zobristSide : 0);
+    entryMove = -1;
+    if (probeTable(state->table, key, &entryDepth, &entryBound, &entryScore, &entryMove)) {
+        if (entryDepth >= depth) {
+            if (entryBound == 3 || (entryBound == 2 && entryScore >= beta) || (entryBound == 1 && entryScore <= alpha)) {
+                return entryScore;
+            }
+        }
+    }
+    
+    moveCount = orderMidgameMoves(state, player, moves, entryMove);
+    if (moveCount == 0) {
+        /* Two passes in a row end the game. */
+        if (passed) {
+            return finalScore(state, player);
+        }
+        value = -searchNode(state, opponent, depth, -beta, -alpha, true);
+        addPassToLine(state, opponent);
+        return value;
+    }
+    
+    originalAlpha = alpha;
+    best = -SCORE_INFINITY;
+    bestMove = moves[0].row * MAX_SIZE + moves[0].col;
+    for (i = 0; i < moveCount; i++) {
+        /* Young Brothers Wait: once the eldest move has set a bound, an idle helper may take the younger ones. */
+        if (i == 1 && depth >= SPLIT_DEPTH && helperIdle(state)) {
+            searchSplit(state, player, moves + 1, moveCount - 1, depth - 1, alpha, beta, &best, &bestMove);
+            if (state->aborted) {
+                return 0;
+            }
+            break;
+        }
+        searchPlay(state, moves[i], player);
+        value = -searchNode(state, opponent, depth - 1, -beta, -alpha, false);
+        searchUndo(state);
+        
+        /* Nothing of an unfinished search goes into the table. */
+        if (state->aborted) {
+            return 0;
+        }
+        
+        if (value > best) {
+            best = value;
+            bestMove = moves[i].row * MAX_SIZE + moves[i].col;
+            if (value > alpha) {
+                alpha = value;
+                updateLine(state, moves[i]);
+                if (alpha >= beta) {
+                    break;
+                }
+            }
+        }
+    }
+    
+    /* Bound 1: the real score is at most best, 2: at least best, 3: exactly best. */
+    if (best <= originalAlpha) {
+        storeTable(state->table, key, depth, 1, best, bestMove);
+    } else if (best >= beta) {
+        storeTable(state->table, key, depth, 2, best, bestMove);
+    } else {
+        storeTable(state->table, key, depth, 3, best, bestMove);
+    }
+    return best;
+}
+
+/* Allocates both arenas of a Monte Carlo tree, megabytes of nodes between them. */
+bool initTree(MctsTree* tree, int megabytes) {
+    tree->capacity = (int)(((size_t)megabytes << 20) / (2 * sizeof(TreeNode)));
+    tree->nodes = (TreeNode*)malloc((size_t)tree->capacity * sizeof(TreeNode));
+    tree->spare = (TreeNode*)malloc((size_t)tree->capacity * sizeof(TreeNode));
+    atomic_init(&tree->used, 0);
+    tree->valid = false;
+    if (!tree->nodes || !tree->spare) {
+        freeTree(tree);
+        return false;
+    }
+    return true;
+}
+
+/* Releases both arenas. */
+void freeTree(MctsTree* tree) {
+    free(tree->nodes);
+    free(tree->spare);
+    tree->nodes = NULL;
+    tree->spare = NULL;
+    tree->valid = false;
+}
+
+/* The cells where player may move, found for the whole board at once. In each direction the runs of opponent discs
+   that end in one of the player's discs are grown a cell at a time, and an empty cell at the start of a run is a move. */
+void legalMoveSet(const CellSet* sets, CellState player, int words, CellSet* moves) {
+    const CellSet* own = &sets[player];
+    const CellSet* other = &sets[opponentOf(player)];
+    CellSet run, next;
+    unsigned long long any;
+    int d, w;
+    
+    memset(moves, 0, sizeof(CellSet));
+    for (d = 0; d < 8; d++) {
+        /* The opponent's discs with one of the player's next to them in this direction. */
+        shiftSet(own, directionSteps[d], words, &run);
+        any = 0;
+        for (w = 0; w < words; w++) {
+            run.words[w] &= other->words[w];
+            any |= run.words[w];
+        }
+        while (any) {
+            shiftSet(&run, directionSteps[d], words, &next);
+            any = 0;
+            for (w = 0; w < words; w++) {
+                moves->words[w] |= next.words[w] & sets[EMPTY].words[w];
+                run.words[w] = next.words[w] & other->words[w];
+                any |= run.words[w];
+            }
+        }
+    }
+}
+
+/* The cell of member n of a set, counting from 0, or -1 if the set is smaller. */
+int nthCell(const CellSet* set, int words, int n) {
+    unsigned long long bits;
+    int count, w;
+    
+    for (w = 0; w < words; w++) {
+        count = __builtin_popcountll(set->words[w]);
+        if (n < count) {
+            for (bits = set->words[w]; n > 0; n--) {
+                bits &= bits - 1;
+            }
+            return w * 64 + __builtin_ctzll(bits);
+        }
+        n -= count;
+    }
+    return -1;
+}
+
+/* Plays a legal move given as a flat board cell and keeps the cell sets in step with the board. */
+void playCell(Board* board, CellSet* sets, int cell, CellState player) {
+    CellState opponent = opponentOf(player);
+    int flips, next, i, k;
+    
+    board->cells[cell] = (unsigned char)player;
+    toggleCell(sets, cell, EMPTY, player);
+    for (i = 0; i < 8; i++) {
+        flips = checkDirection(board, cell, player, directionSteps[i], true);
+        next = cell;
+        for (k = 0; k < flips; k++) {
+            next += directionSteps[i];
+            toggleCell(sets, next, opponent, player);
+        }
+    }
+}
+
+/* Plays random moves until neither side can move and returns the winner, EMPTY for a draw. */
+CellState randomPlayout(Board* board, CellSet* sets, CellState player, int words, unsigned long long* seed) {
+    CellSet moves;
+    int count, passes, computerCount, userCount;
+    
+    passes = 0;
+    while (passes < 2) {
+        legalMoveSet(sets, player, words, &moves);
+        count = countSet(&moves);
+        if (count == 0) {
+            passes++;
+        } else {
+            playCell(board, sets, nthCell(&moves, words, (int)(nextRandom(seed) % count)), player);
+            passes = 0;
+        }
+        player = opponentOf(player);
+    }
+    
+    computerCount = countSet(&sets[COMPUTER]);
+    userCount = countSet(&sets[USER]);
+    if (computerCount == userCount) {
+        return EMPTY;
+    }
+    return computerCount > userCount ? COMPUTER : USER;
+}
+
+/* Looks for the position board with player to move in the tree below node, at most plies moves down.
+   position is the position at node, toMove who moves there. Returns the node that has it, or -1. */
+int findReusedNode(MctsTree* tree, int node, Board* board, CellState player, Board* position, CellState toMove, int plies) {
+    TreeNode* parent = &tree->nodes[node];
+    Board next;
+    Position pos;
+    int found, move, i;
+    
+    if (toMove == player && memcmp(position->cells, board->cells, BOARD_BYTES) == 0) {
+        return node;
+    }
+    if (plies == 0 || atomic_load(&parent->state) != NODE_EXPANDED) {
+        return -1;
+    }
+    for (i = 0; i < parent->childCount; i++) {
+        next = *position;
+        move = tree->nodes[parent->firstChild + i].move;
+        if (move >= 0) {
+            pos.row = move / BOARD_STRIDE - 1;
+            pos.col = move % BOARD_STRIDE - 1;
+            makeMove(&next, pos, toMove);
+        }
+        found = findReusedNode(tree, parent->firstChild + i, board, player, &next, opponentOf(toMove), plies - 1);
+        if (found >= 0) {
+            return found;
+        }
+    }
+    return -1;
+}
+
+/* Makes node the root. Its subtree is copied breadth first to the spare arena, which then becomes the tree, everything else is dropped. */
+void keepSubtree(MctsTree* tree, int node) {
+    TreeNode* swap;
+    int head, tail, i;
+    
+    tree->spare[0] = tree->nodes[node];
+    tail = 1;
+    for (head = 0; head < tail; head++) {
+        if (atomic_load(&tree->spare[head].state) == NODE_EXPANDED) {
+            for (i = 0; i < tree->spare[head].childCount; i++) {
+                tree->spare[tail + i] = tree->nodes[tree->spare[head].firstChild + i];
+            }
+            tree->spare[head].firstChild = tail;
+            tail += tree->spare[head].childCount;
+        }
+    }
+    swap = tree->nodes;
+    tree->nodes = tree->spare;
+    tree->spare = swap;
+    atomic_store(&tree->used, tail);
+}
+
+/* Gives a leaf its children: the legal moves, a single pass, or none at all when the game is over there.
+   Returns false if another thread is already at it or the arena is full, the node then stays a leaf. */
+bool expandNode(MctsTree* tree, int node, CellSet* sets, CellState player, int words) {
+    TreeNode* leaf = &tree->nodes[node];
+    TreeNode* child;
+    CellSet moves;
+    unsigned long long bits;
+    int expected = NODE_LEAF;
+    int count, first, i, w;
+    bool pass;
+    
+    legalMoveSet(sets, player, words, &moves);
+    count = countSet(&moves);
+    pass = count == 0;
+    if (pass) {
+        legalMoveSet(sets, opponentOf(player), words, &moves);
+        count = countSet(&moves) > 0 ? 1 : 0;
+    }
+    
+    if (atomic_load(&tree->used) + count > tree->capacity) {
+        return false;
+    }
+    if (!atomic_compare_exchange_strong(&leaf->state, &expected, NODE_EXPANDING)) {
+        return false;
+    }
+    first = atomic_fetch_add(&tree->used, count);
+    if (first + count > tree->capacity) {
+        atomic_store(&leaf->state, NODE_LEAF);
+        return false;
+    }
+    
+    i = 0;
+    for (w = 0; w < words && i < count; w++) {
+        for (bits = pass ? 1 : moves.words[w]; bits && i < count; bits &= bits - 1) {
+            child = &tree->nodes[first + i++];
+            atomic_init(&child->visits, 0);
+            atomic_init(&child->wins, 0);
+            atomic_init(&child->virtualLoss, 0);
+            atomic_init(&child->state, NODE_LEAF);
+            child->childCount = 0;
+            child->move = pass ? -1 : (short)(w * 64 + __builtin_ctzll(bits));
+        }
+    }
+    leaf->firstChild = first;
+    leaf->childCount = (short)count;
+    atomic_store(&leaf->state, NODE_EXPANDED);
+    return true;
+}
+
+/* Picks the child with the best UCT value and charges it a virtual loss until the playout through it is counted.
+   A child nobody has tried yet comes first. */
+int selectChild(MctsTree* tree, int node) {
+    TreeNode* parent = &tree->nodes[node];
+    TreeNode* child;
+    double logVisits, value, bestValue;
+    int visits, best, i;
+    
+    logVisits = log(atomic_load(&parent->visits) + VIRTUAL_LOSS * atomic_load(&parent->virtualLoss) + 1);
+    best = parent->firstChild;
+    bestValue = -1;
+    for (i = 0; i < parent->childCount; i++) {
+        child = &tree->nodes[parent->firstChild + i];
+        
+        /* A virtual loss is a visit without a win. */
+        visits = atomic_load(&child->visits) + VIRTUAL_LOSS * atomic_load(&child->virtualLoss);
+        if (visits == 0) {
+            best = parent->firstChild + i;
+            break;
+        }
+        value = atomic_load(&child->wins) / (2.0 * visits) + UCT_EXPLORATION * sqrt(logVisits / visits);
+        if (value > bestValue) {
+            bestValue = value;
+            best = parent->firstChild + i;
+        }
+    }
+    atomic_fetch_add(&tree->nodes[best].virtualLoss, 1);
+    return best;
+}
+
+/* Everything the threads of a Monte Carlo search share. */
+typedef struct {
+    MctsTree* tree;
+    CellSet sets[4];          /* The cell sets of the root position. */
+    int words;                /* Words of a CellSet that hold the board. */
+    int playouts;
+    atomic_int next;          /* Playouts started so far. */
+    atomic_int threads;       /* Threads started so far, each gets its own random numbers. */
+    unsigned long long seed;
+} MctsSearch;
+
+/* Runs config->playouts playouts from the position on config->threads threads and returns the move most of them went through,
+   row -1 if there is none. winRate is the share of its playouts player won, draws counting half.
+   The part of the previous search's tree that reaches this position is kept, with all its playouts. */
+Position searchMcts(Board* board, CellState player, const EngineConfig* config, double* winRate) {
+    MctsTree* tree = config->tree;
+    MctsSearch search;
+    pthread_t workers[MAX_THREADS];
+    TreeNode* root;
+    TreeNode* child;
+    Board position;
+    Position bestPos;
+    int node, started, visits, bestVisits, symmetry, i;
+    
+    bestPos.row = -1;
+    bestPos.col = -1;
+    *winRate = 0;
+    
+    /* A kept subtree that fills more than half the arena leaves too little room to grow, the search then starts over. */
+    node = -1;
+    if (tree->valid && tree->board.size == board->size) {
+        position = tree->board;
+        node = findReusedNode(tree, 0, board, player, &position, tree->player, TREE_REUSE_PLIES);
+    }
+    if (node > 0) {
+        keepSubtree(tree, node);
+    }
+    if (node < 0 || atomic_load(&tree->used) > tree->capacity / 2) {
+        root = &tree->nodes[0];
+        atomic_init(&root->visits, 0);
+        atomic_init(&root->wins, 0);
+        atomic_init(&root->virtualLoss, 0);
+        atomic_init(&root->state, NODE_LEAF);
+        root->childCount = 0;
+        root->move = -1;
+        atomic_store(&tree->used, 1);
+    }
+    tree->board = *board;
+    tree->player = player;
+    tree->valid = true;
+    
+    search.tree = tree;
+    boardSets(board, search.sets);
+    search.words = CELL(board->size, board->size) / 64 + 1;
+    search.playouts = config->playouts;
+    search.seed = canonicalKey(board, player, &symmetry);
+    atomic_init(&search.next, 0);
+    atomic_init(&search.threads, 0);
+    
+    started = 0;
+    for (i = 1; i < config->threads; i++) {
+        if (pthread_create(&workers[started], NULL, mctsWorker, &search) == 0) {
+            started++;
+        }
+    }
+    mctsWorker(&search);
+    for (i = 0; i < started; i++) {
+        pthread_join(workers[i], NULL);
+    }
+    
+    root = &tree->nodes[0];
+    if (atomic_load(&root->state) != NODE_EXPANDED) {
+        return bestPos;
+    }
+    bestVisits = 0;
+    for (i = 0; i < root->childCount; i++) {
+        child = &tree->nodes[root->firstChild + i];
+        visits = atomic_load(&child->visits);
+        if (child->move >= 0 && visits > bestVisits) {
+            bestVisits = visits;
+            bestPos.row = child->move / BOARD_STRIDE - 1;
+            bestPos.col = child->move % BOARD_STRIDE - 1;
+            *winRate = atomic_load(&child->wins) / (2.0 * visits);
+        }
+    }
+    return bestPos;
+}
+
+/* A worker runs playouts until the search has enough: down the tree by UCT, one random game from the leaf,
+   and the result back up to every node on the way. */
+void* mctsWorker(void* arg) {
+    MctsSearch* search = (MctsSearch*)arg;
+    MctsTree* tree = search->tree;
+    int path[MAX_GAME_PLIES + 1];
+    CellState movers[MAX_GAME_PLIES + 1]; /* Who made the move into each node of the path. */
+    CellSet sets[4];
+    Board board;
+    TreeNode* node;
+    CellState player, winner;
+    unsigned long long seed;
+    int length, current, child, i;
+    
+    seed = search->seed + (unsigned long long)atomic_fetch_add(&search->threads, 1);
+    seed = nextRandom(&seed);
+    
+    while (atomic_fetch_add(&search->next, 1) < search->playouts) {
+        board = tree->board;
+        memcpy(sets, search->sets, sizeof(sets));
+        player = tree->player;
+        current = 0;
+        path[0] = 0;
+        length = 1;
+        
+        for (;;) {
+            /* A leaf gets its children on its second visit, so the tree only grows where the playouts keep coming back. */
+            if (atomic_load(&tree->nodes[current].state) != NODE_EXPANDED) {
+                if ((current != 0 && atomic_load(&tree->nodes[current].visits) == 0) ||
+                    !expandNode(tree, current, sets, player, search->words)) {
+                    break;
+                }
+            }
+            if (tree->nodes[current].childCount == 0) {
+                break;
+            }
+            child = selectChild(tree, current);
+            if (tree->nodes[child].move >= 0) {
+                playCell(&board, sets, tree->nodes[child].move, player);
+            }
+            movers[length] = player;
+            path[length++] = child;
+            player = opponentOf(player);
+            current = child;
+        }
+        
+        winner = randomPlayout(&board, sets, player, search->words, &seed);
+        atomic_fetch_add(&tree->nodes[0].visits, 1);
+        for (i = 1; i < length; i++) {
+            node = &tree->nodes[path[i]];
+            atomic_fetch_add(&node->wins, winner == movers[i] ? 2 : (winner == EMPTY ? 1 : 0));
+            atomic_fetch_add(&node->visits, 1);
+            atomic_fetch_sub(&node->virtualLoss, 1);
+        }
+    }
+    return NULL;
+}
+
+/* Plays random legal moves from the starting position, the same seed always gives the same opening. */
+void playRandomOpening(Board* board, int moves, unsigned long long* seed) {
+    int size = board->size;
+    Position legal[MAX_CELLS];
+    Position pos;
+    CellState player;
+    int count, i, j, k;
+    
+    initializeBoard(board);
+    player = USER;
+    for (k = 0; k < moves; k++) {
+        count = 0;
+        for (i = 0; i < size; i++) {
+            for (j = 0; j < size; j++) {
+                pos.row = i;
+                pos.col = j;
+                if (isValidMove(board, pos, player)) {
+                    legal[count++] = pos;
+                }
+            }
+        }
+        if (count == 0) {
+            break;
+        }
+        makeMove(board, legal[nextRandom(seed) % count], player);
+        player = opponentOf(player);
+    }
+}
+
+/* Seconds on a clock that keeps running while all threads work, unlike clock(). */
+double wallClock(void) {
+    struct timespec now;
+    
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec + now.tv_nsec / 1e9;
+}
+
+/* Searches the same positions at a fixed depth with one thread and with config->threads, and prints the speedup.
+   The speedup can be no better than the number of cores, so that is printed too. */
+void runBenchmark(const EngineConfig* config) {
+    const int sizes[4] = {8, 12, 16, 20};
+    EngineConfig single;
+    Board* board;
+    unsigned long long seed;
+    double start, singleTime, parallelTime;
+    long long singleNodes, parallelNodes;
+    int score, s;
+    
+    single = *config;
+    single.threads = 1;
+    
+    printf("Search benchmark at depth %d, %d thread(s) against 1, %ld core(s) online.\n", config->depth, config->threads,
+           sysconf(_SC_NPROCESSORS_ONLN));
+    printf("size  1 thread (s)  %2d threads (s)  speedup  nodes (1)  nodes (%d)\n", config->threads, config->threads);
+    for (s = 0; s < 4; s++) {
+        board = allocateBoard(sizes[s]);
+        if (!board) {
+            printf("Memory allocation failed!\n");
+            return;
+        }
+        seed = (unsigned long long)sizes[s];
+        playRandomOpening(board, 10, &seed);
+        
+        /* Each run starts with an empty table, so both see the same amount of work. */
+        clearTable(config->table);
+        start = wallClock();
+        searchMidgame(board, USER, &single, 0, &score, NULL, &singleNodes);
+        singleTime = wallClock() - start;
+        
+        clearTable(config->table);
+        start = wallClock();
+        searchMidgame(board, USER, config, 0, &score, NULL, &parallelNodes);
+        parallelTime = wallClock() - start;
+        
+        printf("%4d  %12.3f  %14.3f  %7.2f  %9lld  %9lld\n", sizes[s], singleTime, parallelTime,
+               parallelTime > 0 ? singleTime / parallelTime : 0.0, singleNodes, parallelNodes);
+        freeBoard(board);
+    }
+}
+
+/* Builds the pattern instances for a board size, with all weights zero. Each type is laid out from the corner at (0,0)
+   and then mirrored to the other corners. The edge and second line run both ways from each corner. */
+PatternSet* createPatterns(int size) {
+    PatternSet* set;
+    int cellRow[MAX_PATTERN_LENGTH], cellCol[MAX_PATTERN_LENGTH];
+    int type, corner, turn, length, power, row, col, cell, k;
+    
+    set = (PatternSet*)calloc(1, sizeof(PatternSet));
+    if (!set) {
+        return NULL;
+    }
+    set->size = size;
+    
+    for (type = 0; type < PATTERN_TYPES; type++) {
+        /* Cells of the type seen from the top left corner. Lines stop at 8 cells, or the board edge if it is closer. */
+        length = size < 8 ? size : 8;
+        for (k = 0; k < MAX_PATTERN_LENGTH; k++) {
+            if (type == 0) {
+                cellRow[k] = k / 3;
+                cellCol[k] = k % 3;
+            } else if (type == 1) {
+                cellRow[k] = 0;
+                cellCol[k] = k;
+            } else if (type == 2) {
+                cellRow[k] = 1;
+                cellCol[k] = k;
+            } else {
+                cellRow[k] = k;
+                cellCol[k] = k;
+            }
+        }
+        if (type == 0) {
+            length = 9;
+        }
+        
+        for (corner = 0; corner < 4; corner++) {
+            /* The corner and the diagonal look the same turned over, the lines do not. */
+            for (turn = 0; turn < ((type == 1 || type == 2) ? 2 : 1); turn++) {
+                power = 1;
+                for (k = 0; k < length; k++) {
+                    row = turn ? cellCol[k] : cellRow[k];
+                    col = turn ? cellRow[k] : cellCol[k];
+                    if (corner & 1) {
+                        col = size - 1 - col;
+                    }
+                    if (corner & 2) {
+                        row = size - 1 - row;
+                    }
+                    cell = row * MAX_SIZE + col;
+                    set->refs[cell][set->refCount[cell]].instance = (short)set->instanceCount;
+                    set->refs[cell][set->refCount[cell]].power = (short)power;
+                    set->refCount[cell]++;
+                    power *= 3;
+                }
+                set->instanceType[set->instanceCount++] = type;
+            }
+        }
+    }
+    return set;
+}
+
+/* Name of the weights file for a board size. */
+void patternWeightsFile(int size, char* name, int length) {
+    snprintf(name, length, "weights%d.bin", size);
+}
+
+/* Loads the trained weights for a board size into the global pattern set. Returns false if there are none. */
+bool loadPatterns(int size) {
+    char name[32];
+    FILE* file;
+    int header[3];
+    PatternSet* set;
+    
+    patternWeightsFile(size, name, sizeof(name));
+    file = fopen(name, "rb");
+    if (!file) {
+        return false;
+    }
+    set = createPatterns(size);
+    
+    /* The file starts with the size and the table layout, so a file from another version is not misread. */
+    if (!set || fread(header, sizeof(int), 3, file) != 3 || header[0] != size || header[1] != PATTERN_PHASES || header[2] != PATTERN_TABLE_SIZE ||
+        fread(set->weights, sizeof(set->weights), 1, file) != 1) {
+        printf("Ignoring the damaged weights file %s.\n", name);
+        free(set);
+        fclose(file);
+        return false;
+    }
+    fclose(file);
+    
+    free(patterns);
+    patterns = set;
+    return true;
+}
+
+/* Writes the weights of a pattern set to its file. */
+bool savePatterns(const PatternSet* set) {
+    char name[32];
+    FILE* file;
+    int header[3];
+    bool ok;
+    
+    patternWeightsFile(set->size, name, sizeof(name));
+    file = fopen(name, "wb");
+    if (!file) {
+        printf("Cannot write %s.\n", name);
+        return false;
+    }
+    header[0] = set->size;
+    header[1] = PATTERN_PHASES;
+    header[2] = PATTERN_TABLE_SIZE;
+    ok = fwrite(header, sizeof(int), 3, file) == 3 && fwrite(set->weights, sizeof(set->weights), 1, file) == 1;
+    if (fclose(file) != 0) {
+        ok = false;
+    }
+    return ok;
+}
+
+/* Which part of the game a position is in, by how full the board is. */
+int patternPhase(int size, int empties) {
+    return (size * size - empties) * PATTERN_PHASES / (size * size + 1);
+}
+
+/* Reads every pattern instance off the board from scratch. */
+void computePatternIndices(const PatternSet* set, Board* board, int* indices) {
+    int i, j, k, cell;
+    
+    for (k = 0; k < set->instanceCount; k++) {
+        indices[k] = 0;
+    }
+    for (i = 0; i < set->size; i++) {
+        for (j = 0; j < set->size; j++) {
+            cell = i * MAX_SIZE + j;
+            for (k = 0; k < set->refCount[cell]; k++) {
+                indices[set->refs[cell][k].instance] += board->cells[CELL(i, j)] * set->refs[cell][k].power;
+            }
+        }
+    }
+}
+
+/* A cell's digit changed by delta, every instance it belongs to changes by delta times the digit's power. */
+void updatePatterns(SearchState* state, Position pos, int delta) {
+    const PatternSet* set = state->patterns;
+    int cell = pos.row * MAX_SIZE + pos.col;
+    int k;
+    
+    for (k = 0; k < set->refCount[cell]; k++) {
+        state->patternIndex[set->refs[cell][k].instance] += delta * set->refs[cell][k].power;
+    }
+}
+
+/* Evaluation from the computer's point of view: one table lookup per pattern instance. */
+int patternScore(const PatternSet* set, const int* indices, int phase) {
+    float sum;
+    int k;
+    
+    sum = 0;
+    for (k = 0; k < set->instanceCount; k++) {
+        sum += set->weights[phase][set->instanceType[k]][indices[k]];
+    }
+    return (int)(sum * PATTERN_SCALE);
+}
+
+/* Plays one game between engines[USER] and engines[COMPUTER] after a few random moves. Fills in the moves, a row of -1 marks a pass,
+   and the seconds each engine move took if moveTimes is not NULL (0 for random and forced moves).
+   Returns the number of moves, and leaves the final position on the board. */
+int playEngineGame(Board* board, const EngineConfig* const* engines, unsigned long long* seed, Position* moves, double* moveTimes) {
+    int size = board->size;
+    Position legal[MAX_CELLS];
+    Position pos;
+    CellState player;
+    double start;
+    int count, moveCount, passes, i, j;
+    
+    initializeBoard(board);
+    player = USER;
+    moveCount = 0;
+    passes = 0;
+    while (passes < 2) {
+        count = 0;
+        for (i = 0; i < size; i++) {
+            for (j = 0; j < size; j++) {
+                pos.row = i;
+                pos.col = j;
+                if (isValidMove(board, pos, player)) {
+                    legal[count++] = pos;
+                }
+            }
+        }
+        
+        start = wallClock();
+        if (count == 0) {
+            pos.row = -1;
+            pos.col = -1;
+            passes++;
+        } else {
+            if (moveCount < OPENING_MOVES) {
+                pos = legal[nextRandom(seed) % count];
+            } else {
+                pos = getComputerMove(board, player, engines[player]);
+            }
+            makeMove(board, pos, player);
+            passes = 0;
+        }
+        if (moveTimes) {
+            moveTimes[moveCount] = (count == 0 || moveCount < OPENING_MOVES) ? 0 : wallClock() - start;
+        }
+        moves[moveCount++] = pos;
+        player = opponentOf(player);
+    }
+    
+    /* The two closing passes are not part of the record. */
+    return moveCount - 2;
+}
+
+/* Writes self-play games to a file, one game per line: the board size and then the moves, for example "8 d3 c5 ...".
+   The random openings come from seed, so the same seed writes the same games. */
+bool generateGames(const EngineConfig* config, int size, int games, unsigned long long seed, const char* fileName) {
+    Position moves[2 * MAX_CELLS];
+    const EngineConfig* engines[3];
+    Board* board;
+    unsigned long long state;
+    FILE* file;
+    int moveCount, g, k;
+    
+    file = fopen(fileName, "w");
+    board = allocateBoard(size);
+    if (!file || !board) {
+        printf("Cannot write %s.\n", fileName);
+        if (file) {
+            fclose(file);
+        }
+        freeBoard(board);
+        return false;
+    }
+    
+    state = seed;
+    engines[EMPTY] = NULL;
+    engines[COMPUTER] = config;
+    engines[USER] = config;
+    for (g = 0; g < games; g++) {
+        moveCount = playEngineGame(board, engines, &state, moves, NULL);
+        fprintf(file, "%d", size);
+        for (k = 0; k < moveCount; k++) {
+            if (moves[k].row >= 0) {
+                fprintf(file, " %c%d", 'a' + moves[k].col, moves[k].row + 1);
+            } else {
+                fprintf(file, " --");
+            }
+        }
+        fprintf(file, "\n");
+    }
+    printf("Wrote %d game(s) to %s, seed %llu.\n", games, fileName, seed);
+    
+    freeBoard(board);
+    fclose(file);
+    return true;
+}
+
+/* Reads one game from a record file. Returns the number of moves, or -1 at the end of the file. */
+int readGameRecord(FILE* file, int* size, Position* moves, int maxMoves) {
+    char line[8 * MAX_CELLS];
+    char* token;
+    int count;
+    
+    if (!fgets(line, sizeof(line), file)) {
+        return -1;
+    }
+    token = strtok(line, " \t\r\n");
+    if (!token) {
+        return 0;
+    }
+    *size = atoi(token);
+    
+    count = 0;
+    while ((token = strtok(NULL, " \t\r\n")) != NULL && count < maxMoves) {
+        if (strcmp(token, "--") == 0) {
+            moves[count].row = -1;
+            moves[count].col = -1;
+        } else {
+            moves[count] = parseMove(token);
+        }
+        count++;
+    }
+    return count;
+}
+
+/* One position of the training set: its pattern indices, its phase and how the game really ended. */
+typedef struct {
+    unsigned short indices[MAX_PATTERNS];
+    unsigned char phase;
+    short result;
+} TrainingSample;
+
+/* Fits the pattern weights to the game records by least squares: every position should predict the game's final
+   disc difference. Plain stochastic gradient descent, each weight's step is scaled by how often it is seen. */
+bool trainPatterns(const char* fileName) {
+    Position moves[2 * MAX_CELLS];
+    TrainingSample* samples;
+    TrainingSample* grown;
+    PatternSet* set;
+    Board* board;
+    CellState player;
+    float* seen;
+    FILE* file;
+    int indices[MAX_PATTERNS];
+    int size, gameSize, moveCount, computerCount, userCount;
+    int sampleCount, sampleCapacity, firstSample, games;
+    int epoch, i, k, table;
+    bool complete, outOfMemory;
+    double error, totalError;
+    float prediction;
+    
+    file = fopen(fileName, "r");
+    if (!file) {
+        printf("Cannot read %s.\n", fileName);
+        return false;
+    }
+    
+    size = 0;
+    set = NULL;
+    board = NULL;
+    samples = NULL;
+    sampleCount = 0;
+    sampleCapacity = 0;
+    games = 0;
+    outOfMemory = false;
+    while (!outOfMemory && (moveCount = readGameRecord(file, &gameSize, moves, 2 * MAX_CELLS)) >= 0) {
+        if (moveCount == 0) {
+            continue;
+        }
+        /* All games must be on the board size of the first one. */
+        if (size == 0) {
+            size = gameSize;
+            if (size < 4 || size > MAX_SIZE || size % 2 != 0) {
+                break;
+            }
+            set = createPatterns(size);
+            board = allocateBoard(size);
+            if (!set || !board) {
+                break;
+            }
+        }
+        if (gameSize != size) {
+            continue;
+        }
+        
+        /* Replays the game and keeps every position, the result is filled in at the end. A game that cannot be
+           replayed to its end is dropped whole, its positions would be labelled with a result it never reached. */
+        initializeBoard(board);
+        player = USER;
+        firstSample = sampleCount;
+        complete = true;
+        for (i = 0; i < moveCount && complete; i++) {
+            if (moves[i].row >= 0) {
+                /* Records without pass marks skip the player who cannot move. */
+                if (!isValidMove(board, moves[i], player) && !hasValidMoves(board, player)) {
+                    player = opponentOf(player);
+                }
+                if (!isValidMove(board, moves[i], player)) {
+                    complete = false;
+                    break;
+                }
+                makeMove(board, moves[i], player);
+            }
+            player = opponentOf(player);
+            
+            if (sampleCount == sampleCapacity) {
+                grown = (TrainingSample*)realloc(samples, (sampleCapacity ? 2 * sampleCapacity : 4096) * sizeof(TrainingSample));
+                if (!grown) {
+                    outOfMemory = true;
+                    complete = false;
+                    break;
+                }
+                samples = grown;
+                sampleCapacity = sampleCapacity ? 2 * sampleCapacity : 4096;
+            }
+            computePatternIndices(set, board, indices);
+            for (k = 0; k < set->instanceCount; k++) {
+                samples[sampleCount].indices[k] = (unsigned short)indices[k];
+            }
+            samples[sampleCount].phase = (unsigned char)patternPhase(size, countEmpties(board));
+            sampleCount++;
+        }
+        if (!complete) {
+            sampleCount = firstSample;
+            continue;
+        }
+        countCells(board, &computerCount, &userCount);
+        for (k = firstSample; k < sampleCount; k++) {
+            samples[k].result = (short)(computerCount - userCount);
+        }
+        games++;
+    }
+    fclose(file);
+    if (outOfMemory) {
+        printf("Out of memory, training on the first %d game(s).\n", games);
+    }
+    
+    if (!set || !board || sampleCount == 0) {
+        printf("No usable games in %s.\n", fileName);
+        free(samples);
+        free(set);
+        freeBoard(board);
+        return false;
+    }
+    freeBoard(board);
+    
+    /* Rarely seen configurations get the full step, common ones a smaller one, so they do not swing around. */
+    seen = (float*)calloc(PATTERN_PHASES * PATTERN_TYPES * PATTERN_TABLE_SIZE, sizeof(float));
+    if (!seen) {
+        free(samples);
+        free(set);
+        return false;
+    }
+    for (i = 0; i < sampleCount; i++) {
+        for (k = 0; k < set->instanceCount; k++) {
+            table = samples[i].phase * PATTERN_TYPES + set->instanceType[k];
+            seen[table * PATTERN_TABLE_SIZE + samples[i].indices[k]] += 1;
+        }
+    }
+    
+    printf("Training on %d positions from %d game(s).\n", sampleCount, games);
+    for (epoch = 0; epoch < TRAINING_EPOCHS; epoch++) {
+        totalError = 0;
+        for (i = 0; i < sampleCount; i++) {
+            prediction = 0;
+            for (k = 0; k < set->instanceCount; k++) {
+                prediction += set->weights[samples[i].phase][set->instanceType[k]][samples[i].indices[k]];
+            }
+            error = samples[i].result - prediction;
+            totalError += error * error;
+            
+            for (k = 0; k < set->instanceCount; k++) {
+                table = samples[i].phase * PATTERN_TYPES + set->instanceType[k];
+                set->weights[samples[i].phase][set->instanceType[k]][samples[i].indices[k]] +=
+                    (float)(error / set->instanceCount / (1.0 + 0.05 * seen[table * PATTERN_TABLE_SIZE + samples[i].indices[k]]));
+            }
+        }
+        printf("Epoch %2d: mean squared error %.2f\n", epoch + 1, totalError / sampleCount);
+    }
+    
+    if (!savePatterns(set)) {
+        free(seen);
+        free(samples);
+        free(set);
+        return false;
+    }
+    printf("Saved the weights for %dx%d.\n", size, size);
+    
+    free(seen);
+    free(samples);
+    free(set);
+    return true;
+}
+
+/* Moves a cell by one of the 8 symmetries of the square: bit 2 mirrors along the diagonal, bit 0 flips the rows, bit 1 the columns. */
+Position transformCell(int size, int symmetry, Position pos) {
+    Position result = pos;
+    
+    if (symmetry & 4) {
+        result.row = pos.col;
+        result.col = pos.row;
+    }
+    if (symmetry & 1) {
+        result.row = size - 1 - result.row;
+    }
+    if (symmetry & 2) {
+        result.col = size - 1 - result.col;
+    }
+    return result;
+}
+
+/* Undoes transformCell. */
+Position untransformCell(int size, int symmetry, Position pos) {
+    Position result = pos;
+    int row;
+    
+    if (symmetry & 1) {
+        result.row = size - 1 - result.row;
+    }
+    if (symmetry & 2) {
+        result.col = size - 1 - result.col;
+    }
+    if (symmetry & 4) {
+        row = result.row;
+        result.row = result.col;
+        result.col = row;
+    }
+    return result;
+}
+
+/* Hashes the position in all 8 orientations and returns the smallest key, so every symmetric copy of a position
+   has the same key. symmetry tells which orientation gave it. */
+unsigned long long canonicalKey(Board* board, CellState player, int* symmetry) {
+    int size = board->size;
+    unsigned long long key, best;
+    Position pos, moved;
+    int t, i, j;
+    
+    best = 0;
+    *symmetry = 0;
+    for (t = 0; t < 8; t++) {
+        key = zobristSizes[size] ^ (player == USER ? zobristSide : 0);
+        for (i = 0; i < size; i++) {
+            for (j = 0; j < size; j++) {
+                pos.row = i;
+                pos.col = j;
+                moved = transformCell(size, t, pos);
+                key ^= zobristCells[moved.row * MAX_SIZE + moved.col][board->cells[CELL(i, j)]];
+            }
+        }
+        if (t == 0 || key < best) {
+            best = key;
+            *symmetry = t;
+        }
+    }
+    return best;
+}
+
+/* Name of the book file for a board size. */
+void bookFile(int size, char* name, int length) {
+    snprintf(name, length, "book%d.bin", size);
+}
+
+/* Maps the book for a board size into memory. Nothing is read up front, the pages come in as lookups touch them. */
+bool openBook(int size) {
+    char name[32];
+    const BookHeader* header;
+    struct stat info;
+    void* data;
+    int fd;
+    
+    closeBook();
+    bookFile(size, name, sizeof(name));
+    fd = open(name, O_RDONLY);
+    if (fd < 0) {
+        return false;
+    }
+    if (fstat(fd, &info) != 0 || (size_t)info.st_size < sizeof(BookHeader)) {
+        close(fd);
+        return false;
+    }
+    data = mmap(NULL, (size_t)info.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd); /* The mapping stays valid without the descriptor. */
+    if (data == MAP_FAILED) {
+        return false;
+    }
+    
+    header = (const BookHeader*)data;
+    if (header->magic != BOOK_MAGIC || header->size != size || header->count < 0 ||
+        (size_t)info.st_size != sizeof(BookHeader) + (size_t)header->count * sizeof(BookEntry)) {
+        printf("Ignoring the damaged book file %s.\n", name);
+        munmap(data, (size_t)info.st_size);
+        return false;
+    }
+    bookEntries = (const BookEntry*)(header + 1);
+    bookCount = header->count;
+    bookBytes = (size_t)info.st_size;
+    return true;
+}
+
+/* Unmaps the book, if one is open. */
+void closeBook(void) {
+    if (bookEntries) {
+        munmap((void*)((const BookHeader*)bookEntries - 1), bookBytes);
+    }
+    bookEntries = NULL;
+    bookCount = 0;
+    bookBytes = 0;
+}
+
+/* Looks the position up in the book with a binary search and turns the stored move back to this orientation. */
+bool bookMove(Board* board, CellState player, Position* pos) {
+    int size = board->size;
+    unsigned long long key;
+    Position stored;
+    int symmetry, low, high, middle;
+    
+    if (!bookEntries) {
+        return false;
+    }
+    key = canonicalKey(board, player, &symmetry);
+    low = 0;
+    high = bookCount - 1;
+    while (low <= high) {
+        middle = low + (high - low) / 2;
+        if (bookEntries[middle].key < key) {
+            low = middle + 1;
+        } else if (bookEntries[middle].key > key) {
+            high = middle - 1;
+        } else {
+            stored.row = bookEntries[middle].move / MAX_SIZE;
+            stored.col = bookEntries[middle].move % MAX_SIZE;
+            *pos = untransformCell(size, symmetry, stored);
+            return isValidMove(board, *pos, player);
+        }
+    }
+    return false;
+}
+
+/* Everything the book builder carries through the move tree. */
+typedef struct {
+    const EngineConfig* config;
+    SearchState* state;
+    int plies;
+    BookEntry* entries;
+    int count;
+    int capacity;
+    unsigned long long* seen; /* Open addressing set of the keys already searched, 0 is an empty slot. */
+    size_t seenCapacity;
+    size_t seenCount;
+    bool failed;
+} BookBuilder;
+
+/* Adds a key to the set of searched positions. Returns false if it was already there. */
+bool rememberBookKey(BookBuilder* builder, unsigned long long key) {
+    unsigned long long* old;
+    size_t oldCapacity, slot, i;
+    
+    /* The set doubles when it is half full. */
+    if (2 * (builder->seenCount + 1) > builder->seenCapacity) {
+        old = builder->seen;
+        oldCapacity = builder->seenCapacity;
+        builder->seenCapacity = oldCapacity ? 2 * oldCapacity : 4096;
+        builder->seen = (unsigned long long*)calloc(builder->seenCapacity, sizeof(unsigned long long));
+        if (!builder->seen) {
+            builder->seen = old;
+            builder->seenCapacity = oldCapacity;
+            builder->failed = true;
+            return false;
+        }
+        for (i = 0; i < oldCapacity; i++) {
+            if (old[i]) {
+                slot = old[i] & (builder->seenCapacity - 1);
+                while (builder->seen[slot]) {
+                    slot = (slot + 1) & (builder->seenCapacity - 1);
+                }
+                builder->seen[slot] = old[i];
+            }
+        }
+        free(old);
+    }
+    
+    key |= 1; /* Keeps 0 free as the empty mark, at the cost of one bit of the key. */
+    slot = key & (builder->seenCapacity - 1);
+    while (builder->seen[slot]) {
+        if (builder->seen[slot] == key) {
+            return false;
+        }
+        slot = (slot + 1) & (builder->seenCapacity - 1);
+    }
+    builder->seen[slot] = key;
+    builder->seenCount++;
+    return true;
+}
+
+/* Searches every new position up to builder->plies moves deep and records its best move. */
+void expandBook(BookBuilder* builder, CellState player, int ply) {
+    SearchState* state = builder->state;
+    Position moves[MAX_CELLS];
+    Position best;
+    BookEntry* grown;
+    unsigned long long key;
+    long long nodes;
+    int symmetry, moveCount, score, i;
+    
+    if (ply >= builder->plies || builder->failed) {
+        return;
+    }
+    key = canonicalKey(&state->board, player, &symmetry);
+    if (!rememberBookKey(builder, key)) {
+        return;
+    }
+    moveCount = orderMidgameMoves(state, player, moves, -1);
+    if (moveCount == 0) {
+        return; /* The opening is never long enough for a pass to matter. */
+    }
+    
+    best = searchMidgame(&state->board, player, builder->config, 0, &score, NULL, &nodes);
+    if (!isValidPosition(state->board.size, best)) {
+        builder->failed = true;
+        return;
+    }
+    if (builder->count == builder->capacity) {
+        builder->capacity = builder->capacity ? 2 * builder->capacity : 1024;
+        grown = (BookEntry*)realloc(builder->entries, builder->capacity * sizeof(BookEntry));
+        if (!grown) {
+            builder->failed = true;
+            return;
+        }
+        builder->entries = grown;
+    }
+    best = transformCell(state->board.size, symmetry, best);
+    builder->entries[builder->count].key = key;
+    builder->entries[builder->count].move = (short)(best.row * MAX_SIZE + best.col);
+    builder->entries[builder->count].score = (short)(score > 32767 ? 32767 : score < -32767 ? -32767 : score);
+    builder->entries[builder->count].depth = builder->config->depth;
+    builder->count++;
+    
+    for (i = 0; i < moveCount; i++) {
+        searchPlay(state, moves[i], player);
+        expandBook(builder, opponentOf(player), ply + 1);
+        searchUndo(state);
+    }
+}
+
+/* Orders book entries by key for the binary search. */
+int compareBookEntries(const void* a, const void* b) {
+    unsigned long long keyA = ((const BookEntry*)a)->key;
+    unsigned long long keyB = ((const BookEntry*)b)->key;
+    
+    return (keyA > keyB) - (keyA < keyB);
+}
+
+/* Builds the book for a board size from a config->depth search of every position in the first plies moves, and writes it sorted. */
+bool buildBook(const EngineConfig* config, int size, int plies) {
+    BookBuilder builder;
+    BookHeader header;
+    Board board;
+    char name[32];
+    FILE* file;
+    bool ok;
+    
+    builder.state = (SearchState*)malloc(sizeof(SearchState));
+    if (!builder.state) {
+        printf("Memory allocation failed!\n");
+        return false;
+    }
+    board.size = size;
+    initializeBoard(&board);
+    initSearch(builder.state, &board);
+    
+    builder.config = config;
+    builder.plies = plies;
+    builder.entries = NULL;
+    builder.count = 0;
+    builder.capacity = 0;
+    builder.seen = NULL;
+    builder.seenCapacity = 0;
+    builder.seenCount = 0;
+    builder.failed = false;
+    expandBook(&builder, USER, 0);
+    free(builder.state);
+    free(builder.seen);
+    if (builder.failed) {
+        printf("Building the book failed.\n");
+        free(builder.entries);
+        return false;
+    }
+    
+    qsort(builder.entries, builder.count, sizeof(BookEntry), compareBookEntries);
+    bookFile(size, name, sizeof(name));
+    file = fopen(name, "wb");
+    if (!file) {
+        printf("Cannot write %s.\n", name);
+        free(builder.entries);
+        return false;
+    }
+    header.magic = BOOK_MAGIC;
+    header.size = size;
+    header.count = builder.count;
+    header.depth = config->depth;
+    ok = fwrite(&header, sizeof(header), 1, file) == 1 &&
+         (size_t)fwrite(builder.entries, sizeof(BookEntry), builder.count, file) == (size_t)builder.count;
+    if (fclose(file) != 0) {
+        ok = false;
+    }
+    if (ok) {
+        printf("Wrote %d positions to %s.\n", builder.count, name);
+    }
+    free(builder.entries);
+    return ok;
+}
+
+/* Reads an engine written as "depth/endgame_empties", or just "depth" with the default endgame.
+   A Monte Carlo engine is written as "mplayouts", with or without the endgame. */
+bool parseEngine(const char* spec, EngineConfig* engine) {
+    char* end;
+    
+    engine->depth = 0;
+    engine->playouts = 0;
+    engine->timeLimit = 0;
+    engine->endgameEmpties = ENDGAME_DEFAULT_EMPTIES;
+    engine->threads = 1;
+    engine->table = NULL;
+    engine->tree = NULL;
+    if (*spec == 'm') {
+        spec++;
+        engine->playouts = (int)strtol(spec, &end, 10);
+        if (end == spec || engine->playouts < 1) {
+            return false;
+        }
+    } else {
+        engine->depth = (int)strtol(spec, &end, 10);
+        if (end == spec || engine->depth < 0 || engine->depth > MAX_DEPTH) {
+            return false;
+        }
+    }
+    if (*end == '/') {
+        spec = end + 1;
+        engine->endgameEmpties = (int)strtol(spec, &end, 10);
+        if (end == spec || engine->endgameEmpties < 0 || engine->endgameEmpties > ENDGAME_MAX_EMPTIES) {
+            return false;
+        }
+    }
+    return *end == '\0';
+}
+
+/* Everything the tournament threads share. Games are played in pairs from the same opening, with the colours swapped. */
+typedef struct {
+    EngineConfig engines[2];
+    int size;
+    int games;
+    unsigned long long seed;
+    int treeMemory;           /* Megabytes of each Monte Carlo tree. */
+    atomic_int next;          /* Index of the next game nobody has started. */
+    pthread_mutex_t lock;     /* Guards everything below. */
+    int wins[2];
+    int draws;
+    int finished;
+    double* times[2];         /* Seconds of every move each engine made. */
+    int timeCount[2];
+    int timeCapacity[2];
+    bool failed;
+} Tournament;
+
+/* Plays tournament games until none are left. Each thread has its own board and its own tables and trees for both engines,
+   so the engines never see each other's search results. */
+void* tournamentWorker(void* arg) {
+    Tournament* tournament = (Tournament*)arg;
+    TranspositionTable tables[2];
+    MctsTree trees[2];
+    EngineConfig engines[2];
+    const EngineConfig* byColour[3];
+    Position moves[2 * MAX_CELLS];
+    double moveTimes[2 * MAX_CELLS];
+    double* grown;
+    Board* board;
+    CellState colourOfFirst;
+    unsigned long long seed;
+    int game, moveCount, computerCount, userCount, firstDiscs, secondDiscs, engine, capacity, k;
+    int timed[2];
+    bool ok;
+    
+    board = allocateBoard(tournament->size);
+    ok = board != NULL;
+    for (k = 0; k < 2; k++) {
+        tables[k].entries = NULL;
+        trees[k].nodes = NULL;
+        trees[k].spare = NULL;
+    }
+    for (k = 0; k < 2 && ok; k++) {
+        engines[k] = tournament->engines[k];
+        engines[k].table = &tables[k];
+        ok = initTable(&tables[k], TOURNAMENT_TABLE_BITS);
+        if (ok && engines[k].playouts > 0) {
+            engines[k].tree = &trees[k];
+            ok = initTree(&trees[k], tournament->treeMemory);
+        }
+    }
+    if (!ok) {
+        pthread_mutex_lock(&tournament->lock);
+        tournament->failed = true;
+        pthread_mutex_unlock(&tournament->lock);
+        for (k = 0; k < 2; k++) {
+            freeTable(&tables[k]);
+            freeTree(&trees[k]);
+        }
+        freeBoard(board);
+        return NULL;
+    }
+    
+    while ((game = atomic_fetch_add(&tournament->next, 1)) < tournament->games) {
+        /* Both games of a pair get the same opening, the first engine moves first in the even one. */
+        seed = tournament->seed + (unsigned long long)(game / 2) * 0x9E3779B97F4A7C15ULL;
+        colourOfFirst = (game % 2 == 0) ? USER : COMPUTER;
+        byColour[EMPTY] = NULL;
+        byColour[colourOfFirst] = &engines[0];
+        byColour[opponentOf(colourOfFirst)] = &engines[1];
+        clearTable(&tables[0]);
+        clearTable(&tables[1]);
+        trees[0].valid = false;
+        trees[1].valid = false;
+        
+        moveCount = playEngineGame(board, byColour, &seed, moves, moveTimes);
+        countCells(board, &computerCount, &userCount);
+        firstDiscs = colourOfFirst == COMPUTER ? computerCount : userCount;
+        secondDiscs = colourOfFirst == COMPUTER ? userCount : computerCount;
+        
+        /* USER makes the even moves. Random opening moves and passes were not timed. */
+        timed[0] = 0;
+        timed[1] = 0;
+        for (k = OPENING_MOVES; k < moveCount; k++) {
+            if (moves[k].row >= 0) {
+                timed[((k % 2 == 0) == (colourOfFirst == USER)) ? 0 : 1]++;
+            }
+        }
+        
+        /* Room for the times is made before anything is counted, so a game whose times would be dropped does not count. */
+        pthread_mutex_lock(&tournament->lock);
+        for (engine = 0; engine < 2 && !tournament->failed; engine++) {
+            capacity = tournament->timeCapacity[engine];
+            while (capacity < tournament->timeCount[engine] + timed[engine]) {
+                capacity = capacity ? 2 * capacity : 4096;
+            }
+            if (capacity != tournament->timeCapacity[engine]) {
+                grown = (double*)realloc(tournament->times[engine], capacity * sizeof(double));
+                if (!grown) {
+                    tournament->failed = true;
+                    break;
+                }
+                tournament->times[engine] = grown;
+                tournament->timeCapacity[engine] = capacity;
+            }
+        }
+        if (tournament->failed) {
+            pthread_mutex_unlock(&tournament->lock);
+            break;
+        }
+        
+        if (firstDiscs > secondDiscs) {
+            tournament->wins[0]++;
+        } else if (secondDiscs > firstDiscs) {
+            tournament->wins[1]++;
+        } else {
+            tournament->draws++;
+        }
+        for (k = OPENING_MOVES; k < moveCount; k++) {
+            if (moves[k].row < 0) {
+                continue;
+            }
+            engine = ((k % 2 == 0) == (colourOfFirst == USER)) ? 0 : 1;
+            tournament->times[engine][tournament->timeCount[engine]++] = moveTimes[k];
+        }
+        tournament->finished++;
+        if (tournament->finished % 100 == 0) {
+            printf("%d/%d games played.\n", tournament->finished, tournament->games);
+            fflush(stdout);
+        }
+        pthread_mutex_unlock(&tournament->lock);
+    }
+    
+    for (k = 0; k < 2; k++) {
+        freeTable(&tables[k]);
+        freeTree(&trees[k]);
+    }
+    freeBoard(board);
+    return NULL;
+}
+
+/* Elo difference that makes the expected score come out as score. */
+double eloFromScore(double score) {
+    if (score < 0.001) {
+        score = 0.001;
+    } else if (score > 0.999) {
+        score = 0.999;
+    }
+    return -400.0 * log10(1.0 / score - 1.0);
+}
+
+/* Orders move times for the percentiles. */
+int compareTimes(const void* a, const void* b) {
+    double timeA = *(const double*)a;
+    double timeB = *(const double*)b;
+    
+    return (timeA > timeB) - (timeA < timeB);
+}
+
+/* Prints the distribution of an engine's move times: percentiles and a histogram with doubling buckets. */
+void printMoveTimes(const char* name, double* times, int count) {
+    int buckets[TIME_BUCKETS];
+    double total, limit;
+    int i, b;
+    
+    if (count == 0) {
+        printf("%s made no timed moves.\n", name);
+        return;
+    }
+    qsort(times, count, sizeof(double), compareTimes);
+    total = 0;
+    for (b = 0; b < TIME_BUCKETS; b++) {
+        buckets[b] = 0;
+    }
+    for (i = 0; i < count; i++) {
+        total += times[i];
+        limit = 0.0001;
+        for (b = 0; b < TIME_BUCKETS - 1 && times[i] >= limit; b++) {
+            limit *= 2;
+        }
+        buckets[b]++;
+    }
+    
+    printf("%s move times (ms): mean %.2f  median %.2f  p90 %.2f  p99 %.2f  max %.2f  (%d moves)\n", name,
+           1000 * total / count, 1000 * times[count / 2], 1000 * times[(int)(count * 0.9)],
+           1000 * times[(int)(count * 0.99)], 1000 * times[count - 1], count);
+    limit = 0.0001;
+    for (b = 0; b < TIME_BUCKETS; b++) {
+        if (buckets[b] > 0) {
+            if (b < TIME_BUCKETS - 1) {
+                printf("  < %8.1f ms: %6d %5.1f%%\n", 1000 * limit, buckets[b], 100.0 * buckets[b] / count);
+            } else {
+                printf("  >=%8.1f ms: %6d %5.1f%%\n", 1000 * limit / 2, buckets[b], 100.0 * buckets[b] / count);
+            }
+        }
+        limit *= 2;
+    }
+}
+
+/* Plays options->count games between the two engines on config->threads threads and reports the Elo difference
+   with a 95% confidence interval, and how long the engines took per move. */
+bool runTournament(const EngineConfig* config, const ProgramOptions* options) {
+    Tournament tournament;
+    pthread_t workers[MAX_THREADS];
+    double start, elapsed, score, deviation, margin, played;
+    int started, i;
+    
+    parseEngine(options->engineSpecs[0], &tournament.engines[0]);
+    parseEngine(options->engineSpecs[1], &tournament.engines[1]);
+    tournament.size = options->size;
+    tournament.games = options->count;
+    tournament.seed = options->seed;
+    tournament.treeMemory = options->treeMemory > 0 ? options->treeMemory : TREE_TOURNAMENT_MEMORY;
+    atomic_init(&tournament.next, 0);
+    pthread_mutex_init(&tournament.lock, NULL);
+    tournament.wins[0] = 0;
+    tournament.wins[1] = 0;
+    tournament.draws = 0;
+    tournament.finished = 0;
+    for (i = 0; i < 2; i++) {
+        tournament.times[i] = NULL;
+        tournament.timeCount[i] = 0;
+        tournament.timeCapacity[i] = 0;
+    }
+    tournament.failed = false;
+    
+    printf("Tournament: %s against %s, %d games on %dx%d, %d thread(s), seed %llu.\n", options->engineSpecs[0], options->engineSpecs[1],
+           options->count, options->size, options->size, config->threads, options->seed);
+    start = wallClock();
+    started = 0;
+    for (i = 1; i < config->threads; i++) {
+        if (pthread_create(&workers[started], NULL, tournamentWorker, &tournament) == 0) {
+            started++;
+        }
+    }
+    tournamentWorker(&tournament);
+    for (i = 0; i < started; i++) {
+        pthread_join(workers[i], NULL);
+    }
+    elapsed = wallClock() - start;
+    pthread_mutex_destroy(&tournament.lock);
+    
+    if (tournament.failed || tournament.finished == 0) {
+        printf("The tournament failed.\n");
+        free(tournament.times[0]);
+        free(tournament.times[1]);
+        return false;
+    }
+    
+    /* Each game scores 1, 0.5 or 0 for the first engine. The interval comes from the spread of those scores. */
+    played = tournament.finished;
+    score = (tournament.wins[0] + 0.5 * tournament.draws) / played;
+    deviation = sqrt(((tournament.wins[0] + 0.25 * tournament.draws) / played - score * score) / played);
+    margin = 1.96 * deviation;
+    
+    printf("\n=== TOURNAMENT RESULT ===\n");
+    printf("%s wins %d, %s wins %d, draws %d (%.1f games/s)\n", options->engineSpecs[0], tournament.wins[0],
+           options->engineSpecs[1], tournament.wins[1], tournament.draws, played / elapsed);
+    printf("Score of %s: %.1f%% +- %.1f%%\n", options->engineSpecs[0], 100 * score, 100 * margin);
+    printf("Elo difference: %+.0f  (95%% interval %+.0f to %+.0f)\n\n", eloFromScore(score),
+           eloFromScore(score - margin), eloFromScore(score + margin));
+    printMoveTimes(options->engineSpecs[0], tournament.times[0], tournament.timeCount[0]);
+    printMoveTimes(options->engineSpecs[1], tournament.times[1], tournament.timeCount[1]);
+    
+    free(tournament.times[0]);
+    free(tournament.times[1]);
+    return true;
+}
+
+/* Reads a position written as the board row by row, X for the computer, O for the user and - or . for an empty cell,
+   then white space and the side to move, X or O. The board size comes from the number of cells. */
+bool parsePosition(const char* text, Board* board, CellState* player) {
+    int length, size, i;
+    
+    while (isspace((unsigned char)*text)) {
+        text++;
+    }
+    length = 0;
+    while (text[length] && !isspace((unsigned char)text[length])) {
+        length++;
+    }
+    size = 4;
+    while (size < MAX_SIZE && size * size < length) {
+        size += 2;
+    }
+    if (size * size != length) {
+        return false;
+    }
+    
+    board->size = size;
+    initializeBoard(board);
+    for (i = 0; i < length; i++) {
+        switch (toupper((unsigned char)text[i])) {
+            case 'X':
+                board->cells[CELL(i / size, i % size)] = COMPUTER;
+                break;
+            case 'O':
+                board->cells[CELL(i / size, i % size)] = USER;
+                break;
+            case '-':
+            case '.':
+                board->cells[CELL(i / size, i % size)] = EMPTY;
+                break;
+            default:
+                return false;
+        }
+    }
+    
+    text += length;
+    while (isspace((unsigned char)*text)) {
+        text++;
+    }
+    switch (toupper((unsigned char)*text)) {
+        case 'X':
+            *player = COMPUTER;
+            break;
+        case 'O':
+            *player = USER;
+            break;
+        default:
+            return false;
+    }
+    text++;
+    while (isspace((unsigned char)*text)) {
+        text++;
+    }
+    return *text == '\0';
+}
+
+/* Writes a line of play as moves like "d3 c5 pass e6", separated by spaces. */
+void formatLine(const Line* line, char* text, int length) {
+    int used, i;
+    
+    text[0] = '\0';
+    used = 0;
+    for (i = 0; i < line->length && used < length; i++) {
+        if (line->moves[i].row < 0) {
+            used += snprintf(text + used, length - used, "%spass", i ? " " : "");
+        } else {
+            used += snprintf(text + used, length - used, "%s%c%d", i ? " " : "", 'a' + line->moves[i].col, line->moves[i].row + 1);
+        }
+    }
+}
+
+/* Everything the analysis threads share. */
+typedef struct {
+    const EngineConfig* config;
+    FILE* file;
+    pthread_mutex_t lock;     /* Guards the file, the output and everything below. */
+    int lines;                /* Lines read so far, results are numbered by their line. */
+    int analyzed;
+    int errors;
+    bool failed;
+} Analysis;
+
+/* Takes positions from the file one line at a time until it runs out, and prints each result as soon as it is found.
+   Every thread searches alone with its own table, which it keeps from one position to the next: positions of the same game share a lot. */
+void* analysisWorker(void* arg) {
+    Analysis* analysis = (Analysis*)arg;
+    TranspositionTable table;
+    EngineConfig engine;
+    char text[2 * MAX_CELLS];
+    char moves[8 * MAX_PLY];
+    const char* start;
+    Board board;
+    CellState player;
+    Position pos;
+    Line pv;
+    double deadline;
+    long long nodes;
+    int index, score, computerCount, userCount;
+    bool exact;
+    
+    if (!initTable(&table, ANALYSIS_TABLE_BITS)) {
+        pthread_mutex_lock(&analysis->lock);
+        analysis->failed = true;
+        pthread_mutex_unlock(&analysis->lock);
+        return NULL;
+    }
+    engine = *analysis->config;
+    engine.threads = 1;
+    engine.table = &table;
+    
+    for (;;) {
+        pthread_mutex_lock(&analysis->lock);
+        if (!fgets(text, sizeof(text), analysis->file)) {
+            pthread_mutex_unlock(&analysis->lock);
+            break;
+        }
+        index = ++analysis->lines;
+        pthread_mutex_unlock(&analysis->lock);
+        
+        /* Blank lines and lines starting with # are comments. */
+        start = text;
+        while (isspace((unsigned char)*start)) {
+            start++;
+        }
+        if (*start == '\0' || *start == '#') {
+            continue;
+        }
+        if (!parsePosition(text, &board, &player)) {
+            pthread_mutex_lock(&analysis->lock);
+            printf("%d error: not a board of X, O and - followed by X or O to move\n", index);
+            fflush(stdout);
+            analysis->errors++;
+            pthread_mutex_unlock(&analysis->lock);
+            continue;
+        }
+        
+        /* The endgame solver gives the exact disc difference, if it finishes in time. Otherwise the midgame search scores the position. */
+        deadline = engine.timeLimit > 0 ? wallClock() + engine.timeLimit : 0;
+        pos.row = -1;
+        exact = false;
+        if (countEmpties(&board) <= engine.endgameEmpties) {
+            pos = solveEndgame(&board, player, &engine, deadline, &score, &pv);
+            exact = isValidPosition(board.size, pos);
+        }
+        if (!exact) {
+            pos = searchMidgame(&board, player, &engine, deadline, &score, &pv, &nodes);
+        }
+        
+        pthread_mutex_lock(&analysis->lock);
+        if (isValidPosition(board.size, pos)) {
+            formatLine(&pv, moves, sizeof(moves));
+            printf("%d %c%d %+d %s %s\n", index, 'a' + pos.col, pos.row + 1, score, exact ? "exact" : "eval", moves);
+        } else if (hasValidMoves(&board, opponentOf(player))) {
+            printf("%d pass\n", index);
+        } else {
+            countCells(&board, &computerCount, &userCount);
+            printf("%d over %+d\n", index, player == COMPUTER ? computerCount - userCount : userCount - computerCount);
+        }
+        fflush(stdout);
+        analysis->analyzed++;
+        pthread_mutex_unlock(&analysis->lock);
+    }
+    
+    freeTable(&table);
+    return NULL;
+}
+
+/* Analyzes every position of a file on config->threads threads, each within config->depth moves or config->timeLimit seconds.
+   Results come out in the order they finish, one line each: the line number, the best move, the score for the side to move,
+   "exact" for a disc difference from the endgame solver or "eval" for a midgame evaluation, and the principal variation. */
+bool runAnalysis(const EngineConfig* config, const ProgramOptions* options) {
+    Analysis analysis;
+    pthread_t workers[MAX_THREADS];
+    double start, elapsed;
+    int started, i;
+    
+    analysis.file = fopen(options->fileName, "r");
+    if (!analysis.file) {
+        printf("Cannot open %s.\n", options->fileName);
+        return false;
+    }
+    analysis.config = config;
+    analysis.lines = 0;
+    analysis.analyzed = 0;
+    analysis.errors = 0;
+    analysis.failed = false;
+    pthread_mutex_init(&analysis.lock, NULL);
+    
+    start = wallClock();
+    started = 0;
+    for (i = 1; i < config->threads; i++) {
+        if (pthread_create(&workers[started], NULL, analysisWorker, &analysis) == 0) {
+            started++;
+        }
+    }
+    analysisWorker(&analysis);
+    for (i = 0; i < started; i++) {
+        pthread_join(workers[i], NULL);
+    }
+    elapsed = wallClock() - start;
+    pthread_mutex_destroy(&analysis.lock);
+    fclose(analysis.file);
+    
+    if (analysis.failed) {
+        printf("Memory allocation failed!\n");
+        return false;
+    }
+    printf("# %d positions analyzed, %d errors, in %.2f s: %.1f positions/s on %d thread(s).\n", analysis.analyzed, analysis.errors,
+           elapsed, elapsed > 0 ? analysis.analyzed / elapsed : 0.0, config->threads);
+    return true;
+}
+
+/* Reads a game record: an optional board size (8 if there is none), then the moves, either separated by spaces like "f5 d6 c3"
+   or run together like "f5d6c3". Passes may be written as "--" or "pass" but are not needed. Returns the number of moves,
+   0 for a blank line and -1 if the line is not a game record. */
+int parseGameText(const char* text, int* size, Position* moves, int maxMoves) {
+    int count, row;
+    
+    while (isspace((unsigned char)*text)) {
+        text++;
+    }
+    *size = 8;
+    if (isdigit((unsigned char)*text)) {
+        *size = (int)strtol(text, (char**)&text, 10);
+        if (*size < 4 || *size > MAX_SIZE || *size % 2 != 0) {
+            return -1;
+        }
+    }
+    
+    count = 0;
+    while (*text) {
+        if (isspace((unsigned char)*text)) {
+            text++;
+        } else if (strncmp(text, "--", 2) == 0) {
+            text += 2;
+        } else if (strncmp(text, "pass", 4) == 0) {
+            text += 4;
+        } else if (isalpha((unsigned char)*text) && isdigit((unsigned char)text[1]) && count < maxMoves) {
+            /* A second digit belongs to the row as long as the row stays on the board, a move never starts with a digit. */
+            moves[count].col = tolower((unsigned char)text[0]) - 'a';
+            row = text[1] - '0';
+            text += 2;
+            if (isdigit((unsigned char)*text) && row * 10 + (*text - '0') <= *size) {
+                row = row * 10 + (*text - '0');
+                text++;
+            }
+            moves[count].row = row - 1;
+            if (!isValidPosition(*size, moves[count])) {
+                return -1;
+            }
+            count++;
+        } else {
+            return -1;
+        }
+    }
+    return count;
+}
+
+/* Fills keys[t][cell][state] with the hash key of state at the cell that symmetry t moves cell to, so the keys of all 8 orientations
+   of a position can be kept up to date move by move. */
+void buildSymmetricKeys(int size, SymmetricKeys* keys) {
+    Position pos, moved;
+    int t, i, j, s;
+    
+    for (t = 0; t < 8; t++) {
+        for (i = 0; i < size; i++) {
+            for (j = 0; j < size; j++) {
+                pos.row = i;
+                pos.col = j;
+                moved = transformCell(size, t, pos);
+                for (s = EMPTY; s <= USER; s++) {
+                    (*keys)[t][i * MAX_SIZE + j][s] = zobristCells[moved.row * MAX_SIZE + moved.col][s];
+                }
+            }
+        }
+    }
+}
+
+/* The same key canonicalKey gives, from the keys of the 8 orientations. */
+unsigned long long smallestKey(const unsigned long long* orientations, CellState player) {
+    unsigned long long key, best;
+    int t;
+    
+    best = orientations[0] ^ (player == USER ? zobristSide : 0);
+    for (t = 1; t < 8; t++) {
+        key = orientations[t] ^ (player == USER ? zobristSide : 0);
+        if (key < best) {
+            best = key;
+        }
+    }
+    return best;
+}
+
+/* Makes room for needed items of itemSize bytes in a growing array. Returns false if memory ran out, the array is still valid then. */
+bool reserveItems(void** items, size_t* capacity, size_t needed, size_t itemSize) {
+    void* grown;
+    size_t larger;
+    
+    if (needed <= *capacity) {
+        return true;
+    }
+    larger = *capacity ? 2 * *capacity : 4096;
+    while (larger < needed) {
+        larger *= 2;
+    }
+    grown = realloc(*items, larger * itemSize);
+    if (!grown) {
+        return false;
+    }
+    *items = grown;
+    *capacity = larger;
+    return true;
+}
+
+/* Sorts index entries by key, 16 bits per pass from the lowest. The sort is stable, so the games of each key stay in order. */
+bool sortPositions(PositionEntry* entries, size_t count) {
+    PositionEntry* scratch;
+    PositionEntry* swap;
+    size_t* counts;
+    size_t total, i, digit;
+    int pass, shift;
+    
+    scratch = (PositionEntry*)malloc(count * sizeof(PositionEntry) + 1);
+    counts = (size_t*)malloc(65536 * sizeof(size_t));
+    if (!scratch || !counts) {
+        free(scratch);
+        free(counts);
+        return false;
+    }
+    
+    /* After 4 passes the sorted entries are back in the caller's array. */
+    for (pass = 0; pass < 4; pass++) {
+        shift = 16 * pass;
+        memset(counts, 0, 65536 * sizeof(size_t));
+        for (i = 0; i < count; i++) {
+            counts[(entries[i].key >> shift) & 0xFFFF]++;
+        }
+        total = 0;
+        for (digit = 0; digit < 65536; digit++) {
+            i = counts[digit];
+            counts[digit] = total;
+            total += i;
+        }
+        for (i = 0; i < count; i++) {
+            scratch[counts[(entries[i].key >> shift) & 0xFFFF]++] = entries[i];
+        }
+        swap = entries;
+        entries = scratch;
+        scratch = swap;
+    }
+    free(scratch);
+    free(counts);
+    return true;
+}
+
+/* Reads game records, one per line, and writes them to a database with an index of every position they reach.
+   Records with an illegal move are skipped. */
+bool importGames(const char* recordName, const char* databaseName) {
+    Position moves[2 * MAX_CELLS];
+    unsigned long long orientations[8];
+    SymmetricKeys* symmetric[MAX_SIZE + 1];
+    char line[8 * MAX_CELLS];
+    DatabaseHeader header;
+    MoveJournal* journal;
+    GameEntry* games;
+    unsigned char* moveBytes;
+    PositionEntry* index;
+    size_t gameCapacity, moveCapacity, indexCapacity, gameCount, moveCount, indexCount;
+    const JournalMove* played;
+    Board board;
+    CellState player, opponent;
+    FILE* file;
+    double start;
+    int size, count, skipped, computerCount, userCount, flips, cell, next, k, t, i, r;
+    bool ok;
+    
+    file = fopen(recordName, "r");
+    if (!file) {
+        printf("Cannot open %s.\n", recordName);
+        return false;
+    }
+    journal = (MoveJournal*)malloc(sizeof(MoveJournal));
+    if (!journal) {
+        fclose(file);
+        printf("Memory allocation failed!\n");
+        return false;
+    }
+    memset(symmetric, 0, sizeof(symmetric));
+    games = NULL;
+    moveBytes = NULL;
+    index = NULL;
+    gameCapacity = moveCapacity = indexCapacity = 0;
+    gameCount = moveCount = indexCount = 0;
+    skipped = 0;
+    ok = true;
+    start = wallClock();
+    
+    while (ok && fgets(line, sizeof(line), file)) {
+        count = parseGameText(line, &size, moves, 2 * MAX_CELLS);
+        if (count == 0) {
+            continue;
+        }
+        if (count < 0 || gameCount == 0xFFFFFFFFu || moveCount + 2 * (size_t)count > 0xFFFFFFFFu) {
+            skipped++;
+            continue;
+        }
+        if (!symmetric[size]) {
+            symmetric[size] = (SymmetricKeys*)malloc(sizeof(SymmetricKeys));
+            if (!symmetric[size]) {
+                ok = false;
+                break;
+            }
+            buildSymmetricKeys(size, symmetric[size]);
+        }
+        if (!reserveItems((void**)&games, &gameCapacity, gameCount + 1, sizeof(GameEntry)) ||
+            !reserveItems((void**)&moveBytes, &moveCapacity, moveCount + 2 * (size_t)count, 1) ||
+            !reserveItems((void**)&index, &indexCapacity, indexCount + count + 1, sizeof(PositionEntry))) {
+            ok = false;
+            break;
+        }
+        
+        board.size = size;
+        initializeBoard(&board);
+        for (t = 0; t < 8; t++) {
+            orientations[t] = zobristSizes[size];
+            for (i = 0; i < size; i++) {
+                for (r = 0; r < size; r++) {
+                    orientations[t] ^= (*symmetric[size])[t][i * MAX_SIZE + r][board.cells[CELL(i, r)]];
+                }
+            }
+        }
+        
+        /* Every position of the game goes into the index, the last one too. Whoever cannot move passes,
+           which only needs checking when the move is not legal for the side whose turn it would be. */
+        player = USER;
+        for (k = 0; k <= count; k++) {
+            journal->count = 0;
+            flips = k < count ? playMove(&board, journal, moves[k], player) : 0;
+            if (flips == 0 && !hasValidMoves(&board, player)) {
+                player = opponentOf(player);
+                flips = k < count ? playMove(&board, journal, moves[k], player) : 0;
+            }
+            index[indexCount + k].key = smallestKey(orientations, player);
+            index[indexCount + k].game = (unsigned int)gameCount;
+            index[indexCount + k].ply = (unsigned int)k;
+            if (k == count || flips == 0) {
+                break;
+            }
+            
+            /* The keys still hold the position before the move. */
+            played = &journal->moves[0];
+            opponent = opponentOf(player);
+            for (t = 0; t < 8; t++) {
+                orientations[t] ^= (*symmetric[size])[t][moves[k].row * MAX_SIZE + moves[k].col][player];
+            }
+            for (i = 0; i < 8; i++) {
+                for (r = 1; r <= played->rays[i]; r++) {
+                    next = (moves[k].row + r * directions[i][0]) * MAX_SIZE + moves[k].col + r * directions[i][1];
+                    for (t = 0; t < 8; t++) {
+                        orientations[t] ^= (*symmetric[size])[t][next][opponent] ^ (*symmetric[size])[t][next][player];
+                    }
+                }
+            }
+            
+            cell = moves[k].row * size + moves[k].col;
+            if (size * size > 256) {
+                moveBytes[moveCount + 2 * k] = (unsigned char)(cell >> 8);
+                moveBytes[moveCount + 2 * k + 1] = (unsigned char)cell;
+            } else {
+                moveBytes[moveCount + k] = (unsigned char)cell;
+            }
+            player = opponent;
+        }
+        if (k < count) {
+            skipped++;
+            continue;
+        }
+        
+        /* USER always moves first. */
+        countCells(&board, &computerCount, &userCount);
+        games[gameCount].offset = (unsigned int)moveCount;
+        games[gameCount].moveCount = (unsigned short)count;
+        games[gameCount].size = (unsigned char)size;
+        games[gameCount].result = (short)(userCount - computerCount);
+        gameCount++;
+        moveCount += (size * size > 256 ? 2 : 1) * (size_t)count;
+        indexCount += count + 1;
+    }
+    fclose(file);
+    free(journal);
+    for (size = 0; size <= MAX_SIZE; size++) {
+        free(symmetric[size]);
+    }
+    
+    /* The moves are padded so the index that follows them starts on a multiple of 8 bytes. */
+    if (ok) {
+        ok = reserveItems((void**)&moveBytes, &moveCapacity, moveCount + 8, 1) && sortPositions(index, indexCount);
+    }
+    if (ok) {
+        memset(moveBytes + moveCount, 0, 8);
+        while ((sizeof(header) + gameCount * sizeof(GameEntry) + moveCount) % 8 != 0) {
+            moveCount++;
+        }
+        file = fopen(databaseName, "wb");
+        header.magic = DATABASE_MAGIC;
+        header.gameCount = (unsigned int)gameCount;
+        header.moveBytes = moveCount;
+        header.indexCount = indexCount;
+        ok = file != NULL &&
+             fwrite(&header, sizeof(header), 1, file) == 1 &&
+             fwrite(games, sizeof(GameEntry), gameCount, file) == gameCount &&
+             fwrite(moveBytes, 1, moveCount, file) == moveCount &&
+             fwrite(index, sizeof(PositionEntry), indexCount, file) == indexCount;
+        if (file && fclose(file) != 0) {
+            ok = false;
+        }
+        if (!ok) {
+            printf("Cannot write %s.\n", databaseName);
+        }
+    } else {
+        printf("Memory allocation failed!\n");
+    }
+    free(games);
+    free(moveBytes);
+    free(index);
+    
+    if (ok) {
+        printf("Imported %zu games (%d records skipped) with %zu positions into %s in %.2f s.\n",
+               gameCount, skipped, indexCount, databaseName, wallClock() - start);
+    }
+    return ok;
+}
+
+/* Maps a game database into memory, read-only and shared, so any number of threads and processes can query it at once. */
+bool openDatabase(const char* name, GameDatabase* database) {
+    struct stat info;
+    const unsigned char* data;
+    const DatabaseHeader* header;
+    void* mapped;
+    int fd;
+    
+    fd = open(name, O_RDONLY);
+    if (fd < 0) {
+        printf("Cannot open %s.\n", name);
+        return false;
+    }
+    if (fstat(fd, &info) != 0 || (size_t)info.st_size < sizeof(DatabaseHeader)) {
+        close(fd);
+        printf("%s is not a game database.\n", name);
+        return false;
+    }
+    mapped = mmap(NULL, (size_t)info.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (mapped == MAP_FAILED) {
+        printf("Cannot map %s.\n", name);
+        return false;
+    }
+    
+    data = (const unsigned char*)mapped;
+    header = (const DatabaseHeader*)data;
+    if (header->magic != DATABASE_MAGIC || header->moveBytes < 0 || header->indexCount < 0 ||
+        (size_t)info.st_size != sizeof(DatabaseHeader) + header->gameCount * sizeof(GameEntry) + (size_t)header->moveBytes +
+                                (size_t)header->indexCount * sizeof(PositionEntry)) {
+        printf("%s is not a game database.\n", name);
+        munmap(mapped, (size_t)info.st_size);
+        return false;
+    }
+    database->header = header;
+    database->games = (const GameEntry*)(header + 1);
+    database->moves = (const unsigned char*)(database->games + header->gameCount);
+    database->index = (const PositionEntry*)(database->moves + header->moveBytes);
+    database->bytes = (size_t)info.st_size;
+    return true;
+}
+
+/* Unmaps a database. */
+void closeDatabase(GameDatabase* database) {
+    if (database->header) {
+        munmap((void*)database->header, database->bytes);
+    }
+    database->header = NULL;
+}
+
+/* Finds the index entries of a position key with a binary search. Returns how many there are, they start at *first. */
+size_t findPositions(const GameDatabase* database, unsigned long long key, size_t* first) {
+    size_t low, high, middle, end;
+    
+    low = 0;
+    high = (size_t)database->header->indexCount;
+    while (low < high) {
+        middle = low + (high - low) / 2;
+        if (database->index[middle].key < key) {
+            low = middle + 1;
+        } else {
+            high = middle;
+        }
+    }
+    *first = low;
+    end = low;
+    while (end < (size_t)database->header->indexCount && database->index[end].key == key) {
+        end++;
+    }
+    return end - low;
+}
+
+/* Move k of a game of the database. */
+Position gameMove(const GameDatabase* database, const GameEntry* game, int k) {
+    const unsigned char* bytes = database->moves + game->offset;
+    Position pos;
+    int cell;
+    
+    if (game->size * game->size > 256) {
+        cell = bytes[2 * k] << 8 | bytes[2 * k + 1];
+    } else {
+        cell = bytes[k];
+    }
+    pos.row = cell / game->size;
+    pos.col = cell % game->size;
+    return pos;
+}
+
+/* Looks up every position of a query file, written as for the batch analysis, and prints how many games reached it or one of
+   its symmetric copies, how they ended for the side that moved first, and the first few of them. */
+bool queryDatabase(const char* databaseName, const char* queryName) {
+    GameDatabase database;
+    char text[2 * MAX_CELLS];
+    const GameEntry* game;
+    const char* start;
+    Board board;
+    Position pos;
+    CellState player;
+    FILE* file;
+    unsigned long long key;
+    size_t first, count, i;
+    double begin, elapsed;
+    int wins, losses, draws, symmetry, lineNumber, k;
+    
+    if (!openDatabase(databaseName, &database)) {
+        return false;
+    }
+    file = fopen(queryName, "r");
+    if (!file) {
+        printf("Cannot open %s.\n", queryName);
+        closeDatabase(&database);
+        return false;
+    }
+    printf("%s: %u games, %lld positions.\n", databaseName, database.header->gameCount, database.header->indexCount);
+    
+    lineNumber = 0;
+    while (fgets(text, sizeof(text), file)) {
+        lineNumber++;
+        start = text;
+        while (isspace((unsigned char)*start)) {
+            start++;
+        }
+        if (*start == '\0' || *start == '#') {
+            continue;
+        }
+        if (!parsePosition(text, &board, &player)) {
+            printf("%d error: not a board of X, O and - followed by X or O to move\n", lineNumber);
+            continue;
+        }
+        
+        begin = wallClock();
+        key = canonicalKey(&board, player, &symmetry);
+        count = findPositions(&database, key, &first);
+        wins = losses = draws = 0;
+        for (i = first; i < first + count; i++) {
+            game = &database.games[database.index[i].game];
+            if (game->result > 0) {
+                wins++;
+            } else if (game->result < 0) {
+                losses++;
+            } else {
+                draws++;
+            }
+        }
+        elapsed = wallClock() - begin;
+        
+        printf("%d: %zu games, first mover won %d, lost %d, drew %d (%.3f ms)\n", lineNumber, count, wins, losses, draws, 1000 * elapsed);
+        for (i = first; i < first + count && i < first + DATABASE_SHOWN_GAMES; i++) {
+            game = &database.games[database.index[i].game];
+            printf("  game %u, position after move %u, result %+d:", database.index[i].game, database.index[i].ply, game->result);
+            for (k = 0; k < game->moveCount; k++) {
+                pos = gameMove(&database, game, k);
+                printf(" %c%d", 'a' + pos.col, pos.row + 1);
+            }
+            printf("\n");
+        }
+    }
+    fclose(file);
+    closeDatabase(&database);
+    return true;
+}